@@ -2,21 +2,2785 @@
 #define ap_number_h
 
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <new>
+#include <initializer_list>
+#include <vector>
 #include <deque>
+#include <map>
+#include <optional>
 #include <iostream>
 #include <iomanip>
 #include <utility>
 #include <string>
 #include <stdexcept>
 #include <cassert>
+#include <limits>
+#include <type_traits>
+
+#if !defined(AP_NUMBER_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define AP_NUMBER_SIMD 1
+#define AP_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define AP_TARGET_AVX2 __attribute__((target("avx2")))
+#define AP_TARGET_AVX512 __attribute__((target("avx512f,avx2")))
+#include <immintrin.h>
+#endif
+
+// Digit base of numbers built without one, e.g. 1000000000 (Number::DECIMAL_BASE)
+// makes decimal input and output a plain regrouping of digits.
+#ifndef AP_NUMBER_DEFAULT_BASE
+#define AP_NUMBER_DEFAULT_BASE 640000000
+#endif
+
+namespace ArbitraryPrecision {
+
+/*
+Memory resource
+	Heap blocks of digit buffers come from the calling thread's current
+	std::pmr::memory_resource, std::pmr::new_delete_resource() by default.
+	MemoryScope swaps it for its lifetime, e.g. a whole computation on one
+	monotonic arena, released in one shot afterwards:
+
+		std::pmr::monotonic_buffer_resource arena;
+		{
+			MemoryScope scope{ &arena };
+			result = cal_pi(100000);	// result is outside the scope, it gets a copy
+		}
+
+	A buffer keeps the resource it was built with. Numbers built inside the
+	scope must not outlive the resource. Moving them into a Number built with
+	another resource copies the digits.
+*/
+inline std::pmr::memory_resource*& current_memory_resource()
+{
+	thread_local std::pmr::memory_resource* resource = std::pmr::new_delete_resource();
+	return resource;
+}
+
+inline std::pmr::memory_resource* get_memory_resource() { return current_memory_resource(); }
+
+class MemoryScope
+{
+public:
+	explicit MemoryScope(std::pmr::memory_resource* resource)
+		: _saved{ current_memory_resource() }
+	{
+		current_memory_resource() = resource;
+	}
+
+	~MemoryScope() { current_memory_resource() = _saved; }
+
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator = (const MemoryScope&) = delete;
+
+private:
+	std::pmr::memory_resource* _saved;
+};
+
+/*
+DigitBuffer
+	Contiguous digit storage, least significant digit first.
+
+	The digits live in the middle of one heap block, with spare room at both
+	ends, so growing toward the high end (carry out) and toward the low end
+	(more fraction digits) are both amortized O(1), and kernels can run over
+	plain int* spans.
+
+	[ ...head room... | d0 d1 d2 ... dn-1 | ...tail room... ]
+	                    ^ data()
+
+	Up to INLINE_CAPACITY digits are kept inside the buffer itself, so small
+	numbers (integer constants, loop counters, comparands) never touch the heap.
+	Heap blocks come from the memory resource current at construction.
+
+	Heap blocks are reference counted and copied on write: a copy only shares
+	the block (within one memory resource), each buffer keeps its own view
+	(_offset, _size) of it. Every non-const access to the digits makes the
+	block unique first, shrinking the view (pop_*, clear) does not.
+*/
+class DigitBuffer
+{
+public:
+	DigitBuffer() = default;
+
+	DigitBuffer(std::initializer_list<int> init)
+	{
+		assign(init.begin(), init.end());
+	}
+
+	DigitBuffer(const DigitBuffer& other)
+	{
+		if (!share(other))
+			assign(other.begin(), other.end());
+	}
+
+	DigitBuffer(DigitBuffer&& other) noexcept
+		: _resource{ other._resource }
+	{
+		steal(other);
+	}
+
+	~DigitBuffer() { release(); }
+
+	DigitBuffer& operator = (const DigitBuffer& other)
+	{
+		if (this != &other && !share(other))
+			assign(other.begin(), other.end());
+		return *this;
+	}
+
+	// Blocks only change owner within one memory resource, across resources
+	// the digits are copied. That may allocate, so unlike the move constructor
+	// this is not noexcept (as std::pmr containers with unequal allocators).
+	DigitBuffer& operator = (DigitBuffer&& other)
+	{
+		if (this == &other)
+			return *this;
+
+		if (_resource == other._resource || !other._block)
+		{
+			release();
+			steal(other);
+		}
+		else
+			assign(other.begin(), other.end());
+		return *this;
+	}
+
+	DigitBuffer& operator = (std::initializer_list<int> init)
+	{
+		assign(init.begin(), init.end());
+		return *this;
+	}
+
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+
+	int* data() { if (shared()) detach(); return block() + _offset; }
+	const int* data() const { return block() + _offset; }
+
+	bool is_inline() const { return !_block; }
+	bool shared() const { return _block && refs().load(std::memory_order_acquire) != 1; }
+	std::pmr::memory_resource* resource() const { return _resource; }
+
+	int* begin() { return data(); }
+	int* end() { return data() + _size; }
+	const int* begin() const { return data(); }
+	const int* end() const { return data() + _size; }
+
+	int& operator [] (size_t index) { return data()[index]; }
+	const int& operator [] (size_t index) const { return data()[index]; }
+
+	// front: least significant digit, back: most significant digit.
+	int& front() { return data()[0]; }
+	int& back() { return data()[_size - 1]; }
+	const int& front() const { return data()[0]; }
+	const int& back() const { return data()[_size - 1]; }
+
+	void assign(const int* first, const int* last)
+	{
+		size_t count = size_t(last - first);
+		prepare(count);
+
+		// keep the digits centered, so both ends have room to grow.
+		_offset = (_capacity - count) / 2;
+		_size = count;
+		std::memmove(data(), first, count * sizeof(int));
+	}
+
+	void assign(size_t count, int value)
+	{
+		prepare(count);
+
+		_offset = (_capacity - count) / 2;
+		_size = count;
+		std::fill(begin(), end(), value);
+	}
+
+	void clear() { _offset += _size / 2; _size = 0; }
+
+	void push_back(int value)
+	{
+		if (_offset + _size == _capacity)
+			reallocate(_size + 1, 0, 1);
+
+		data()[_size++] = value;
+	}
+
+	void push_front(int value)
+	{
+		if (_offset == 0)
+			reallocate(_size + 1, 1, 0);
+
+		_offset--;
+		_size++;
+		front() = value;
+	}
+
+	void pop_back(size_t count = 1) { assert(count <= _size); _size -= count; }
+	void pop_front(size_t count = 1) { assert(count <= _size); _offset += count; _size -= count; }
+
+	// Grow/shrink at the high end, new digits are set to value.
+	void resize(size_t new_size, int value = 0)
+	{
+		if (new_size <= _size)
+		{
+			_size = new_size;
+			return;
+		}
+
+		size_t count = new_size - _size;
+		if (_offset + new_size > _capacity)
+			reallocate(new_size, 0, count);
+
+		std::fill(end(), end() + count, value);
+		_size = new_size;
+	}
+
+	// Grow at the low end, new digits are set to value.
+	void extend_front(size_t count, int value = 0)
+	{
+		if (_offset < count)
+			reallocate(_size + count, count, 0);
+
+		_offset -= count;
+		_size += count;
+		std::fill(begin(), begin() + count, value);
+	}
+
+	void shrink_to_fit()
+	{
+		if (_block && _capacity > _size)
+			reallocate(_size, 0, 0, true);
+	}
+
+	// Digits kept without a heap block.
+	static constexpr size_t INLINE_CAPACITY = 6;
+
+protected:
+
+	// A heap block is [ reference count | digits ], _block points to the digits.
+	static constexpr size_t HEADER_BYTES = alignof(std::max_align_t);
+	static_assert(sizeof(std::atomic<size_t>) <= HEADER_BYTES, "reference count does not fit the block header");
+
+	std::atomic<size_t>& refs() const { return *reinterpret_cast<std::atomic<size_t>*>(reinterpret_cast<char*>(_block) - HEADER_BYTES); }
+
+	int* block() { return _block ? _block : _inline; }
+	const int* block() const { return _block ? _block : _inline; }
+	const int* cdata() const { return block() + _offset; }
+
+	int* allocate(size_t capacity)
+	{
+		char* memory = static_cast<char*>(_resource->allocate(HEADER_BYTES + capacity * sizeof(int), alignof(std::max_align_t)));
+		new (memory) std::atomic<size_t>{ 1 };
+		return reinterpret_cast<int*>(memory + HEADER_BYTES);
+	}
+
+	void release()
+	{
+		if (_block && refs().fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			refs().~atomic();
+			_resource->deallocate(reinterpret_cast<char*>(_block) - HEADER_BYTES, HEADER_BYTES + _capacity * sizeof(int), alignof(std::max_align_t));
+		}
+		_block = nullptr;
+	}
+
+	// Share the heap block of other, when both use the same memory resource.
+	bool share(const DigitBuffer& other)
+	{
+		if (!other._block || other._resource != _resource)
+			return false;
+
+		if (_block != other._block)
+		{
+			other.refs().fetch_add(1, std::memory_order_relaxed);
+			release();
+			_block = other._block;
+			_capacity = other._capacity;
+		}
+		_offset = other._offset;
+		_size = other._size;
+		return true;
+	}
+
+	// Own copy of a shared block, same capacity and view.
+	void detach()
+	{
+		int* new_block = allocate(_capacity);
+		std::memcpy(new_block + _offset, cdata(), _size * sizeof(int));
+		release();
+		_block = new_block;
+	}
+
+	// Room for count digits which are all going to be written.
+	void prepare(size_t count)
+	{
+		if (shared())
+		{
+			release();
+			_capacity = INLINE_CAPACITY;
+			_offset = _size = 0;
+		}
+
+		if (count > _capacity)
+			reallocate(count, 0, 0);
+	}
+
+	// Take over other's digits (no block of our own): a heap block changes
+	// owner, inline digits are copied.
+	void steal(DigitBuffer& other)
+	{
+		assert(!_block);
+		_block = other._block;
+		_capacity = other._capacity;
+		_offset = other._offset;
+		_size = other._size;
+		if (!_block)
+			std::memcpy(_inline + _offset, other._inline + _offset, _size * sizeof(int));
+		else
+			_resource = other._resource;
+
+		other._block = nullptr;
+		other._capacity = INLINE_CAPACITY;
+		other._offset = other._size = 0;
+	}
+
+	// Move digits into a new block of at least min_size, with the spare room
+	// split between both ends, and at least lo_room/hi_room on either side.
+	// An exact fit small enough goes back to the inline digits.
+	void reallocate(size_t min_size, size_t lo_room, size_t hi_room, bool exact = false)
+	{
+		size_t new_capacity = exact ? min_size : std::max<size_t>(min_size * 2, 8);
+		new_capacity = std::max(new_capacity, _size + lo_room + hi_room);
+
+		if (exact && new_capacity <= INLINE_CAPACITY)
+		{
+			if (_block)
+			{
+				std::memcpy(_inline, cdata(), _size * sizeof(int));
+				release();
+			}
+			else
+				std::memmove(_inline, cdata(), _size * sizeof(int));
+
+			_capacity = INLINE_CAPACITY;
+			_offset = 0;
+			return;
+		}
+
+		size_t spare = new_capacity - _size - lo_room - hi_room;
+		size_t new_offset = lo_room + spare / 2;
+
+		int* new_block = allocate(new_capacity);
+		if (_size)
+			std::memcpy(new_block + new_offset, cdata(), _size * sizeof(int));
+
+		release();
+		_block = new_block;
+		_capacity = new_capacity;
+		_offset = new_offset;
+	}
+
+	std::pmr::memory_resource* _resource = get_memory_resource();
+	int* _block = nullptr;
+	size_t _capacity = INLINE_CAPACITY;
+	size_t _offset = 0;
+	size_t _size = 0;
+	int _inline[INLINE_CAPACITY];
+};
+
+// Containers move their buffers (and Numbers) when they grow, instead of copying them.
+static_assert(std::is_nothrow_move_constructible<DigitBuffer>::value, "DigitBuffer must move without throwing");
+
+/*
+Kernel
+	Low level routines over raw digit spans.
+
+	* Digits are stored least significant first, each digit in [0, base).
+	* base <= 2^30, so the product of two digits fits in 60 bits.
+*/
+namespace Kernel {
+
+using u64 = unsigned long long;
+using u32 = unsigned int;
+
+// Operand sizes (in digits) from which multiplication switches to the next
+// algorithm. Tune them on the running machine if needed.
+inline int MUL_KARATSUBA_THRESHOLD = 48;
+inline int MUL_TOOM3_THRESHOLD = 400;
+inline int MUL_NTT_THRESHOLD = 1500;
+
+// Threads of the shared pool, the caller included (1: serial), and the
+// operand size (in digits) from which recursive algorithms fork subtasks.
+// Results do not depend on them.
+inline int THREADS = 1;
+inline int PARALLEL_GRAIN = 4000;
+
+// Divisor and quotient size (in digits) from which division uses a Newton reciprocal.
+inline int DIV_NEWTON_THRESHOLD = 700;
+
+// Digits below which base conversion runs Horner's rule instead of divide and conquer.
+inline int CONVERT_DC_THRESHOLD = 32;
+
+// Bytes of scratch memory a thread keeps between kernel calls, more is freed.
+inline size_t WORKSPACE_LIMIT = size_t(64) << 20;
+
+/*
+Workspace
+	Per-thread stack of memory blocks for kernel temporaries.
+
+	A ScratchFrame marks the top on entry and pops back to it on exit, so
+	nested kernels (Karatsuba => Toom => NTT) share the same memory, and
+	deallocation is a no-op. When the outermost frame closes, the blocks are
+	merged into one of the largest size needed so far (the high-water mark),
+	which is kept for the next call, or freed if over WORKSPACE_LIMIT. A
+	steady-state loop then allocates nothing.
+
+	It is also a std::pmr::memory_resource, for containers which grow. What
+	a frame takes while a nested frame is open goes away with the nested one.
+*/
+class Workspace : public std::pmr::memory_resource
+{
+public:
+	static Workspace& local()
+	{
+		thread_local Workspace workspace;
+		return workspace;
+	}
+
+	Workspace() = default;
+	Workspace(const Workspace&) = delete;
+	Workspace& operator = (const Workspace&) = delete;
+
+	~Workspace()
+	{
+		for (auto& block : _blocks)
+			::operator delete(block.memory);
+	}
+
+	// Bytes held.
+	size_t footprint() const
+	{
+		size_t bytes = 0;
+		for (auto& block : _blocks)
+			bytes += block.size;
+		return bytes;
+	}
+
+	// Most bytes in use at once.
+	size_t high_water() const { return _high_water; }
+
+	// Free all blocks, outside of any frame.
+	void release()
+	{
+		assert(!_depth);
+		for (auto& block : _blocks)
+			::operator delete(block.memory);
+		_blocks.clear();
+		_high_water = 0;
+	}
+
+protected:
+	friend class ScratchFrame;
+
+	struct Block
+	{
+		char* memory;
+		size_t size;
+		size_t before;		// bytes in the blocks before this one
+	};
+
+	struct Mark
+	{
+		size_t block;
+		size_t used;
+	};
+
+	Mark push()
+	{
+		_depth++;
+		return { _current, _used };
+	}
+
+	void pop(Mark mark)
+	{
+		_current = mark.block;
+		_used = mark.used;
+		if (--_depth)
+			return;
+
+		if (_high_water > WORKSPACE_LIMIT)
+			release();
+		else if (_blocks.size() > 1)
+		{
+			size_t size = _high_water;
+			release();
+			_high_water = size;
+			add_block(size);
+		}
+	}
+
+	void add_block(size_t size)
+	{
+		size_t before = _blocks.empty() ? 0 : _blocks.back().before + _blocks.back().size;
+		_blocks.push_back({ static_cast<char*>(::operator new(size)), size, before });
+	}
+
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		assert(_depth);
+		for (;; _current++, _used = 0)
+		{
+			if (_current == _blocks.size())
+			{
+				size_t last = _blocks.empty() ? 0 : _blocks.back().size;
+				add_block(std::max({ bytes + alignment, last * 2, size_t(1) << 16 }));
+			}
+
+			Block& block = _blocks[_current];
+			size_t address = reinterpret_cast<size_t>(block.memory) + _used;
+			size_t start = _used + (alignment - address % alignment) % alignment;
+			if (start + bytes <= block.size)
+			{
+				_used = start + bytes;
+				_high_water = std::max(_high_water, block.before + _used);
+				return block.memory + start;
+			}
+		}
+	}
+
+	void do_deallocate(void*, size_t, size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+	std::vector<Block> _blocks;
+	size_t _current = 0;	// block at the top
+	size_t _used = 0;		// bytes used in it
+	size_t _high_water = 0;
+	int _depth = 0;
+};
+
+// Scratch memory, valid until the frame goes out of scope.
+class ScratchFrame
+{
+public:
+	ScratchFrame() : _workspace{ Workspace::local() }, _mark{ _workspace.push() } {}
+	~ScratchFrame() { _workspace.pop(_mark); }
+
+	ScratchFrame(const ScratchFrame&) = delete;
+	ScratchFrame& operator = (const ScratchFrame&) = delete;
+
+	// n uninitialized values
+	template<class T> T* alloc(size_t n) { return static_cast<T*>(_workspace.allocate(n * sizeof(T), alignof(T))); }
+
+	template<class T> T* alloc_zero(size_t n)
+	{
+		T* p = alloc<T>(n);
+		std::fill(p, p + n, T(0));
+		return p;
+	}
+
+	std::pmr::memory_resource* resource() { return &_workspace; }
+
+private:
+	Workspace& _workspace;
+	Workspace::Mark _mark;
+};
+
+/*
+Tasks
+	Recursive algorithms (Karatsuba/Toom trees, NTT layers, divide and
+	conquer conversion, binary splitting) fork subtasks into a TaskGroup and
+	join them:
+
+		TaskGroup group;
+		group.fork([&]() { high = convert(upper half); });
+		low = convert(lower half);
+		group.join();
+
+	Forks go to the thread's current Executor. By default that is the
+	process-wide WorkStealingPool, THREADS - 1 workers shared by every
+	computation, so concurrent ones do not add threads. ExecutorScope swaps
+	it, e.g. for the application's own thread pool. Forking is only worth it
+	from PARALLEL_GRAIN digits on, see worth_forking().
+
+	join() runs the forked tasks no thread has started yet itself, and only
+	waits for the ones already running. So nested groups never wait on work
+	nobody runs, whatever the executor. Results do not depend on the order.
+
+	A fork runs under the memory resource of the thread that forked it, so
+	the Numbers it builds can be moved into the caller's without a copy.
+	That resource is then used from several threads at once, which only
+	the default std::pmr::new_delete_resource() is known to allow: work that
+	builds Numbers (conversion halves, binary splitting) is only forked
+	outside of a MemoryScope, see may_fork_numbers(). Under an arena it runs
+	on the caller, kernel products (scratch memory only) still fork.
+*/
+class Executor
+{
+public:
+	using Job = std::function<void()>;
+
+	virtual ~Executor() = default;
+
+	// Run job later, on any thread.
+	virtual void submit(Job job) = 0;
+
+	// Threads that run jobs, a waiting caller included.
+	virtual int concurrency() const = 0;
+
+	// Run one queued job on the calling thread if there is one, while it waits in join().
+	virtual bool run_one() { return false; }
+};
+
+/*
+WorkStealingPool
+	Each worker has a deque: it pushes and pops its own forks at the back
+	(depth first, the data is still in cache), idle workers steal from the
+	front of the others (the largest pending subtrees). Jobs from other
+	threads go to a shared injection queue. Workers are started on first
+	use, up to THREADS - 1.
+*/
+class WorkStealingPool : public Executor
+{
+public:
+	static WorkStealingPool& shared()
+	{
+		static WorkStealingPool pool;
+		return pool;
+	}
+
+	WorkStealingPool() = default;
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator = (const WorkStealingPool&) = delete;
+
+	~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock{ _sleep_mutex };
+			_stop = true;
+		}
+		_wake.notify_all();
+
+		for (auto& worker : _workers)
+			worker.join();
+	}
+
+	void submit(Job job) override
+	{
+		grow(std::min(THREADS - 1, MAX_WORKERS));
+
+		int self = worker_index();
+		Queue& queue = self >= 0 ? _queues[self] : _injected;
+		{
+			std::lock_guard<std::mutex> lock{ queue.mutex };
+			queue.jobs.push_back(std::move(job));
+		}
+
+		{
+			std::lock_guard<std::mutex> lock{ _sleep_mutex };
+			_pending++;
+		}
+		_wake.notify_one();
+	}
+
+	int concurrency() const override { return std::max(1, THREADS); }
+
+	bool run_one() override
+	{
+		Job job;
+		if (!take(worker_index(), job))
+			return false;
+
+		job();
+		return true;
+	}
+
+private:
+	static constexpr int MAX_WORKERS = 256;
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	// Index of the calling thread among this pool's workers, -1 for other threads.
+	int worker_index() const
+	{
+		return t_pool == this ? t_index : -1;
+	}
+
+	void grow(int workers)
+	{
+		if (_count.load(std::memory_order_acquire) >= workers)
+			return;
+
+		std::lock_guard<std::mutex> lock{ _grow_mutex };
+		for (int index = _count.load(); index < workers; index++)
+		{
+			_workers.emplace_back([this, index]() { work(index); });
+			_count.store(index + 1, std::memory_order_release);
+		}
+	}
+
+	static bool pop(Queue& queue, Job& job, bool back)
+	{
+		std::lock_guard<std::mutex> lock{ queue.mutex };
+		if (queue.jobs.empty())
+			return false;
+
+		if (back)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		return true;
+	}
+
+	// Own queue first, then the injected jobs, then steal from the other workers.
+	bool take(int self, Job& job)
+	{
+		bool found = (self >= 0 && pop(_queues[self], job, true)) || pop(_injected, job, false);
+
+		int count = _count.load(std::memory_order_acquire);
+		for (int i = 1; !found && i <= count; i++)
+		{
+			int victim = (std::max(self, 0) + i) % count;
+			found = victim != self && pop(_queues[victim], job, false);
+		}
+
+		if (found)
+			_pending--;
+
+		return found;
+	}
+
+	void work(int index)
+	{
+		t_pool = this;
+		t_index = index;
+
+		for (;;)
+		{
+			Job job;
+			if (take(index, job))
+			{
+				job();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock{ _sleep_mutex };
+			_wake.wait(lock, [this]() { return _stop || _pending > 0; });
+			if (_stop)
+				return;
+		}
+	}
+
+	static inline thread_local const WorkStealingPool* t_pool = nullptr;
+	static inline thread_local int t_index = -1;
+
+	std::unique_ptr<Queue[]> _queues{ new Queue[MAX_WORKERS] };
+	Queue _injected;
+	std::atomic<int> _count{ 0 };
+	std::atomic<int> _pending{ 0 };
+	std::mutex _grow_mutex;
+	std::vector<std::thread> _workers;
+
+	std::mutex _sleep_mutex;
+	std::condition_variable _wake;
+	bool _stop = false;
+};
+
+inline Executor*& current_executor_ptr()
+{
+	thread_local Executor* executor = nullptr;
+	return executor;
+}
+
+// The executor forks of the calling thread go to, the shared pool unless an ExecutorScope is open.
+inline Executor& current_executor()
+{
+	Executor* executor = current_executor_ptr();
+	return executor ? *executor : WorkStealingPool::shared();
+}
+
+class ExecutorScope
+{
+public:
+	explicit ExecutorScope(Executor& executor)
+		: _saved{ current_executor_ptr() }
+	{
+		current_executor_ptr() = &executor;
+	}
+
+	~ExecutorScope() { current_executor_ptr() = _saved; }
+
+	ExecutorScope(const ExecutorScope&) = delete;
+	ExecutorScope& operator = (const ExecutorScope&) = delete;
+
+private:
+	Executor* _saved;
+};
+
+class TaskGroup
+{
+public:
+	explicit TaskGroup(Executor& executor = current_executor())
+		: _executor{ executor }
+	{
+	}
+
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator = (const TaskGroup&) = delete;
+
+	~TaskGroup()
+	{
+		// forks capture the caller's locals, they must be done before those go.
+		finish();
+	}
+
+	// Run task on the executor, or in join() if no thread took it by then.
+	template <class Task>
+	void fork(Task&& task)
+	{
+		auto forked = std::make_shared<Forked>();
+		forked->task = std::forward<Task>(task);
+		_forked.push_back(forked);
+
+		{
+			std::lock_guard<std::mutex> lock{ _state->mutex };
+			_state->pending++;
+		}
+
+		// tasks fork into the same executor and allocate from the same resource, whichever thread runs them.
+		auto state = _state;
+		Executor* executor = &_executor;
+		std::pmr::memory_resource* resource = current_memory_resource();
+		_executor.submit([forked, state, executor, resource]()
+		{
+			ExecutorScope scope{ *executor };
+			MemoryScope memory{ resource };
+			run(*forked, *state);
+		});
+	}
+
+	// Wait for all forks, rethrow the first exception one of them threw.
+	void join()
+	{
+		finish();
+
+		std::exception_ptr error;
+		std::swap(error, _state->error);
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+private:
+	struct Forked
+	{
+		std::function<void()> task;
+		std::atomic<bool> claimed{ false };
+	};
+
+	struct State
+	{
+		std::mutex mutex;
+		std::condition_variable done;
+		int pending = 0;
+		std::exception_ptr error;
+	};
+
+	static void run(Forked& forked, State& state)
+	{
+		if (forked.claimed.exchange(true))
+			return;
+
+		std::exception_ptr error;
+		try
+		{
+			forked.task();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock{ state.mutex };
+		if (error && !state.error)
+			state.error = error;
+
+		if (--state.pending == 0)
+			state.done.notify_all();
+	}
+
+	void finish()
+	{
+		// the latest fork first, as the owner of a deque would.
+		for (auto forked = _forked.rbegin(); forked != _forked.rend(); ++forked)
+			run(**forked, *_state);
+
+		_forked.clear();
+
+		std::unique_lock<std::mutex> lock{ _state->mutex };
+		while (_state->pending)
+		{
+			lock.unlock();
+			bool helped = _executor.run_one();
+			lock.lock();
+
+			if (!helped)
+				_state->done.wait(lock, [this]() { return _state->pending == 0; });
+		}
+	}
+
+	Executor& _executor;
+	std::shared_ptr<State> _state = std::make_shared<State>();
+	std::vector<std::shared_ptr<Forked>> _forked;
+};
+
+// Whether work on operands of digits digits is worth forking.
+inline bool worth_forking(int digits)
+{
+	return digits >= PARALLEL_GRAIN && current_executor().concurrency() > 1;
+}
+
+// Whether work building Numbers on operands of digits digits is worth forking, on the default memory resource only.
+inline bool may_fork_numbers(int digits)
+{
+	return worth_forking(digits) && current_memory_resource() == std::pmr::new_delete_resource();
+}
+
+// task(0) ... task(count - 1), tasks 1 ... count - 1 forked when fork is set.
+template <class Task>
+inline void fork_tasks(int count, bool fork, Task&& task)
+{
+	if (count > 1 && fork)
+	{
+		TaskGroup group;
+		for (int i = 1; i < count; i++)
+			group.fork([&task, i]() { task(i); });
+
+		task(0);
+		return group.join();
+	}
+
+	for (int i = 0; i < count; i++)
+		task(i);
+}
+
+// task(0) ... task(count - 1), forked when worth_forking(digits).
+template <class Task>
+inline void run_tasks(int count, int digits, Task&& task)
+{
+	fork_tasks(count, worth_forking(digits), task);
+}
+
+/*
+CPU dispatch
+	The linear kernels (add_n, sub_n, mul_1, addmul_1, to_chars and the NTT
+	butterfly layers) have a scalar version and, with GCC or Clang on
+	x86-64, SSE4.1, AVX2 and AVX-512 ones compiled with target attributes,
+	so one build runs on any x86-64. dispatch() is the table of the best
+	ones for the running CPU, filled once on first use. Define
+	AP_NUMBER_NO_SIMD to leave the vector code out.
+
+	Digits are not powers of 2, so carries are resolved on lane bit masks:
+	lane i generates a carry when its sum reaches base, and propagates one
+	when it is base - 1. With G, P the masks and c the carry in, the carries
+	into the lanes are ((G | P) + G + c) ^ P, bit n is the carry out.
+*/
+enum class Cpu { SCALAR, SSE4, AVX2, AVX512 };
+
+inline Cpu detect_cpu()
+{
+#ifdef AP_NUMBER_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return Cpu::AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return Cpu::AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return Cpu::SSE4;
+#endif
+	return Cpu::SCALAR;
+}
+
+// Montgomery arithmetic modulo an odd prime p < 2^31, R = 2^32.
+struct Modulus
+{
+	u32 p;
+	u32 neg_inv;	// -p^-1 mod R
+	u32 r2;			// R^2 mod p
+
+	explicit Modulus(u32 prime)
+		: p{ prime }
+	{
+		u32 inv = prime;
+		for (int i = 0; i < 5; i++)
+			inv *= 2 - prime * inv;
+
+		neg_inv = 0 - inv;
+		u64 r1 = (u64(1) << 32) % p;
+		r2 = u32(r1 * r1 % p);
+	}
+
+	// a * b / R mod p
+	u32 mul(u32 a, u32 b) const
+	{
+		u64 t = u64(a) * b;
+		u32 m = u32(t) * neg_inv;
+		u32 u = u32((t + u64(m) * p) >> 32);
+		return u >= p ? u - p : u;
+	}
+
+	u32 add(u32 a, u32 b) const { u32 s = a + b; return s >= p ? s - p : s; }
+	u32 sub(u32 a, u32 b) const { return a >= b ? a - b : a + p - b; }
+
+	u32 to_mont(u32 a) const { return mul(a % p, r2); }
+};
+
+// r[0, n) = a[0, n) + b[0, n) + carry, return the carry out.
+inline int add_n_scalar(int* r, const int* a, const int* b, int n, int base, int carry)
+{
+	for (int k = 0; k < n; k++)
+	{
+		int digit = a[k] + b[k] + carry;
+		carry = digit >= base;
+		r[k] = carry ? digit - base : digit;
+	}
+	return carry;
+}
+
+// r[0, n) = a[0, n) - b[0, n) - borrow, return the borrow out.
+inline int sub_n_scalar(int* r, const int* a, const int* b, int n, int base, int borrow)
+{
+	for (int k = 0; k < n; k++)
+	{
+		int digit = a[k] - b[k] - borrow;
+		borrow = digit < 0;
+		r[k] = borrow ? digit + base : digit;
+	}
+	return borrow;
+}
+
+// r[0, n) = a[0, n) * k + carry, return the carry out.
+inline int mul_1_scalar(int* r, const int* a, int n, int k, int base, u64 carry = 0)
+{
+	for (int i = 0; i < n; i++)
+	{
+		u64 v = u64(a[i]) * u64(k) + carry;
+		carry = v / u64(base);
+		r[i] = int(v - carry * u64(base));
+	}
+
+	return int(carry);
+}
+
+// digits[0, n) => chars, most significant digit first, width chars per digit (base^width == digit base).
+inline void to_chars_scalar(char* out, const int* digits, int n, int base, int width)
+{
+	static const char digit_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	for (int m = 0; m < n; m++, out += width)
+	{
+		int x = digits[n - 1 - m];
+		for (int i = width - 1; i >= 0; i--)
+		{
+			out[i] = digit_chars[x % base];
+			x /= base;
+		}
+	}
+}
+
+// acc[0, n) += b[0, n) * k, one row of mul_basecase, carries are left in the 64-bit columns.
+inline void addmul_1_scalar(u64* acc, const int* b, int n, u32 k)
+{
+	for (int j = 0; j < n; j++)
+		acc[j] += u64(k) * u64(b[j]);
+}
+
+// One decimation in frequency layer: blocks of 2 * len, x[j], y[j] = x[j] + y[j], (x[j] - y[j]) * w[j].
+// Only the first count (<= len) butterflies of each block, a slice of the layer.
+inline void ntt_dif_scalar(u32* a, int n, int len, int count, const u32* w, const Modulus& modulus)
+{
+	const Modulus mod = modulus;	// a local copy, stores to a[] cannot alias it
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j++)
+		{
+			u32 u = x[j], v = y[j];
+			x[j] = mod.add(u, v);
+			y[j] = mod.mul(mod.sub(u, v), w[j]);
+		}
+	}
+}
+
+// One decimation in time layer: x[j], y[j] = x[j] + y[j] * w[j], x[j] - y[j] * w[j].
+inline void ntt_dit_scalar(u32* a, int n, int len, int count, const u32* w, const Modulus& modulus)
+{
+	const Modulus mod = modulus;	// a local copy, stores to a[] cannot alias it
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j++)
+		{
+			u32 u = x[j], v = mod.mul(y[j], w[j]);
+			x[j] = mod.add(u, v);
+			y[j] = mod.sub(u, v);
+		}
+	}
+}
+
+#ifdef AP_NUMBER_SIMD
+
+AP_TARGET_SSE4 inline int add_n_sse4(int* r, const int* a, const int* b, int n, int base, int carry)
+{
+	const __m128i top = _mm_set1_epi32(base - 1);
+	const __m128i vbase = _mm_set1_epi32(base);
+	const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+
+	int k = 0;
+	for (; k + 4 <= n; k += 4)
+	{
+		__m128i s = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(a + k)), _mm_loadu_si128((const __m128i*)(b + k)));
+		__m128i g = _mm_cmpgt_epi32(s, top);
+		s = _mm_sub_epi32(s, _mm_and_si128(g, vbase));
+		unsigned gen = unsigned(_mm_movemask_ps(_mm_castsi128_ps(g)));
+		unsigned prop = unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(s, top))));
+
+		unsigned sum = (gen | prop) + gen + unsigned(carry);
+		unsigned in = (sum ^ prop) & 0xf;
+		carry = int(sum >> 4);
+		if (in)
+		{
+			__m128i one = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(in)), lanes), lanes);
+			s = _mm_sub_epi32(s, one);
+			s = _mm_andnot_si128(_mm_cmpeq_epi32(s, vbase), s);
+		}
+		_mm_storeu_si128((__m128i*)(r + k), s);
+	}
+
+	return add_n_scalar(r + k, a + k, b + k, n - k, base, carry);
+}
+
+AP_TARGET_SSE4 inline int sub_n_sse4(int* r, const int* a, const int* b, int n, int base, int borrow)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vbase = _mm_set1_epi32(base);
+	const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+
+	int k = 0;
+	for (; k + 4 <= n; k += 4)
+	{
+		__m128i d = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(a + k)), _mm_loadu_si128((const __m128i*)(b + k)));
+		__m128i g = _mm_cmpgt_epi32(zero, d);
+		d = _mm_add_epi32(d, _mm_and_si128(g, vbase));
+		unsigned gen = unsigned(_mm_movemask_ps(_mm_castsi128_ps(g)));
+		unsigned prop = unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(d, zero))));
+
+		unsigned sum = (gen | prop) + gen + unsigned(borrow);
+		unsigned in = (sum ^ prop) & 0xf;
+		borrow = int(sum >> 4);
+		if (in)
+		{
+			__m128i one = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(in)), lanes), lanes);
+			d = _mm_add_epi32(d, one);
+			d = _mm_add_epi32(d, _mm_and_si128(_mm_cmpgt_epi32(zero, d), vbase));
+		}
+		_mm_storeu_si128((__m128i*)(r + k), d);
+	}
+
+	return sub_n_scalar(r + k, a + k, b + k, n - k, base, borrow);
+}
+
+AP_TARGET_SSE4 inline void addmul_1_sse4(u64* acc, const int* b, int n, u32 k)
+{
+	const __m128i vk = _mm_set1_epi64x(k);
+
+	int j = 0;
+	for (; j + 4 <= n; j += 4)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(b + j));
+		__m128i lo = _mm_mul_epu32(_mm_cvtepu32_epi64(x), vk);
+		__m128i hi = _mm_mul_epu32(_mm_cvtepu32_epi64(_mm_srli_si128(x, 8)), vk);
+		_mm_storeu_si128((__m128i*)(acc + j), _mm_add_epi64(_mm_loadu_si128((const __m128i*)(acc + j)), lo));
+		_mm_storeu_si128((__m128i*)(acc + j + 2), _mm_add_epi64(_mm_loadu_si128((const __m128i*)(acc + j + 2)), hi));
+	}
+
+	addmul_1_scalar(acc + j, b + j, n - j, k);
+}
+
+/*
+	Montgomery product of the lanes, as Modulus::mul: the even and odd
+	lanes go through 32 x 32 => 64-bit products separately, the results in
+	[0, 2p) are reduced with an unsigned min of u and u - p.
+*/
+AP_TARGET_SSE4 inline __m128i mont_mul_sse4(__m128i a, __m128i b, __m128i p, __m128i neg_inv)
+{
+	__m128i t_even = _mm_mul_epu32(a, b);
+	__m128i t_odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	__m128i u_even = _mm_add_epi64(t_even, _mm_mul_epu32(_mm_mul_epu32(t_even, neg_inv), p));
+	__m128i u_odd = _mm_add_epi64(t_odd, _mm_mul_epu32(_mm_mul_epu32(t_odd, neg_inv), p));
+	__m128i u = _mm_blend_epi16(_mm_srli_epi64(u_even, 32), u_odd, 0xcc);
+	return _mm_min_epu32(u, _mm_sub_epi32(u, p));
+}
+
+AP_TARGET_SSE4 inline void ntt_dif_sse4(u32* a, int n, int len, int count, const u32* w, const Modulus& mod)
+{
+	if (count % 4)
+		return ntt_dif_scalar(a, n, len, count, w, mod);
+
+	const __m128i p = _mm_set1_epi32(int(mod.p));
+	const __m128i neg_inv = _mm_set1_epi32(int(mod.neg_inv));
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j += 4)
+		{
+			__m128i u = _mm_loadu_si128((const __m128i*)(x + j));
+			__m128i v = _mm_loadu_si128((const __m128i*)(y + j));
+			__m128i sum = _mm_add_epi32(u, v);
+			__m128i diff = _mm_sub_epi32(u, v);
+			_mm_storeu_si128((__m128i*)(x + j), _mm_min_epu32(sum, _mm_sub_epi32(sum, p)));
+			diff = _mm_min_epu32(diff, _mm_add_epi32(diff, p));
+			_mm_storeu_si128((__m128i*)(y + j), mont_mul_sse4(diff, _mm_loadu_si128((const __m128i*)(w + j)), p, neg_inv));
+		}
+	}
+}
+
+AP_TARGET_SSE4 inline void ntt_dit_sse4(u32* a, int n, int len, int count, const u32* w, const Modulus& mod)
+{
+	if (count % 4)
+		return ntt_dit_scalar(a, n, len, count, w, mod);
+
+	const __m128i p = _mm_set1_epi32(int(mod.p));
+	const __m128i neg_inv = _mm_set1_epi32(int(mod.neg_inv));
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j += 4)
+		{
+			__m128i u = _mm_loadu_si128((const __m128i*)(x + j));
+			__m128i v = mont_mul_sse4(_mm_loadu_si128((const __m128i*)(y + j)), _mm_loadu_si128((const __m128i*)(w + j)), p, neg_inv);
+			__m128i sum = _mm_add_epi32(u, v);
+			__m128i diff = _mm_sub_epi32(u, v);
+			_mm_storeu_si128((__m128i*)(x + j), _mm_min_epu32(sum, _mm_sub_epi32(sum, p)));
+			_mm_storeu_si128((__m128i*)(y + j), _mm_min_epu32(diff, _mm_add_epi32(diff, p)));
+		}
+	}
+}
+
+// s[i] in [0, 2 * base), + carry into lane 0 => digits in [0, base), carry out.
+AP_TARGET_AVX2 inline __m256i resolve_carries_avx2(__m256i s, __m256i top, __m256i vbase, int& carry)
+{
+	const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+	__m256i g = _mm256_cmpgt_epi32(s, top);
+	s = _mm256_sub_epi32(s, _mm256_and_si256(g, vbase));
+	unsigned gen = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(g)));
+	unsigned prop = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(s, top))));
+
+	unsigned sum = (gen | prop) + gen + unsigned(carry);
+	unsigned in = (sum ^ prop) & 0xff;
+	carry = int(sum >> 8);
+	if (!in)
+		return s;
+
+	__m256i one = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(in)), lanes), lanes);
+	s = _mm256_sub_epi32(s, one);
+	return _mm256_andnot_si256(_mm256_cmpeq_epi32(s, vbase), s);
+}
+
+AP_TARGET_AVX2 inline int add_n_avx2(int* r, const int* a, const int* b, int n, int base, int carry)
+{
+	const __m256i top = _mm256_set1_epi32(base - 1);
+	const __m256i vbase = _mm256_set1_epi32(base);
+
+	int k = 0;
+	for (; k + 8 <= n; k += 8)
+	{
+		__m256i s = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(a + k)), _mm256_loadu_si256((const __m256i*)(b + k)));
+		_mm256_storeu_si256((__m256i*)(r + k), resolve_carries_avx2(s, top, vbase, carry));
+	}
+
+	return add_n_scalar(r + k, a + k, b + k, n - k, base, carry);
+}
+
+AP_TARGET_AVX2 inline int sub_n_avx2(int* r, const int* a, const int* b, int n, int base, int borrow)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i vbase = _mm256_set1_epi32(base);
+	const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+	int k = 0;
+	for (; k + 8 <= n; k += 8)
+	{
+		__m256i d = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(a + k)), _mm256_loadu_si256((const __m256i*)(b + k)));
+		__m256i g = _mm256_cmpgt_epi32(zero, d);
+		d = _mm256_add_epi32(d, _mm256_and_si256(g, vbase));
+		unsigned gen = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(g)));
+		unsigned prop = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(d, zero))));
+
+		unsigned sum = (gen | prop) + gen + unsigned(borrow);
+		unsigned in = (sum ^ prop) & 0xff;
+		borrow = int(sum >> 8);
+		if (in)
+		{
+			__m256i one = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(int(in)), lanes), lanes);
+			d = _mm256_add_epi32(d, one);
+			d = _mm256_add_epi32(d, _mm256_and_si256(_mm256_cmpgt_epi32(zero, d), vbase));
+		}
+		_mm256_storeu_si256((__m256i*)(r + k), d);
+	}
+
+	return sub_n_scalar(r + k, a + k, b + k, n - k, base, borrow);
+}
+
+/*
+	k <= base: a * k = q * base + lo with q < base, q from a * (k / base) in
+	double precision (off by at most 1, fixed on lo), then lo[i] + q[i - 1]
+	< 2 * base is resolved as an addition.
+*/
+AP_TARGET_AVX2 inline int mul_1_avx2(int* r, const int* a, int n, int k, int base)
+{
+	if (k > base)
+		return mul_1_scalar(r, a, n, k, base);
+
+	const __m256i vk = _mm256_set1_epi64x(k);
+	const __m256i base64 = _mm256_set1_epi64x(base);
+	const __m256i top64 = _mm256_set1_epi64x(base - 1);
+	const __m256d ratio = _mm256_set1_pd(double(k) / double(base));
+	const __m256i top = _mm256_set1_epi32(base - 1);
+	const __m256i vbase = _mm256_set1_epi32(base);
+	const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	const __m256i up = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+
+	int carry = 0;
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i q[2], lo[2];
+		for (int h = 0; h < 2; h++)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(a + i + 4 * h));
+			__m256i product = _mm256_mul_epu32(_mm256_cvtepu32_epi64(x), vk);
+			__m256i quotient = _mm256_cvtepu32_epi64(_mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtepi32_pd(x), ratio)));
+			__m256i rest = _mm256_sub_epi64(product, _mm256_mul_epu32(quotient, base64));
+
+			__m256i under = _mm256_cmpgt_epi64(_mm256_setzero_si256(), rest);
+			__m256i over = _mm256_cmpgt_epi64(rest, top64);
+			rest = _mm256_sub_epi64(_mm256_add_epi64(rest, _mm256_and_si256(under, base64)), _mm256_and_si256(over, base64));
+			quotient = _mm256_sub_epi64(_mm256_add_epi64(quotient, under), over);
+
+			q[h] = _mm256_permutevar8x32_epi32(quotient, pack);
+			lo[h] = _mm256_permutevar8x32_epi32(rest, pack);
+		}
+
+		__m256i q8 = _mm256_permute2x128_si256(q[0], q[1], 0x20);
+		__m256i lo8 = _mm256_permute2x128_si256(lo[0], lo[1], 0x20);
+
+		// q[i - 1] onto lane i, the carry from the previous block on lane 0
+		int next = _mm256_extract_epi32(q8, 7);
+		__m256i shifted = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(q8, up), _mm256_set1_epi32(carry), 1);
+
+		int bit = 0;
+		__m256i digits = resolve_carries_avx2(_mm256_add_epi32(lo8, shifted), top, vbase, bit);
+		_mm256_storeu_si256((__m256i*)(r + i), digits);
+		carry = next + bit;
+	}
+
+	return mul_1_scalar(r + i, a + i, n - i, k, base, u64(carry));
+}
+
+// base 10^9 digits => 9 decimal chars each, 8 digits at a time.
+AP_TARGET_AVX2 inline void to_chars_avx2(char* out, const int* digits, int n, int base, int width)
+{
+	if (base != 10 || width != 9)
+		return to_chars_scalar(out, digits, n, base, width);
+
+	const __m256i magic = _mm256_set1_epi32(int(0xCCCCCCCD));
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+	int m = 0;
+	alignas(32) int column[9][8];
+	for (; m + 8 <= n; m += 8, out += 72)
+	{
+		__m256i x = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(digits + n - m - 8)), reverse);
+		for (int i = 8; i >= 0; i--)
+		{
+			// x / 10 = (x * 0xCCCCCCCD) >> 35
+			__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(x, magic), 35);
+			__m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), magic), 35);
+			__m256i q = _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+
+			__m256i ten_q = _mm256_add_epi32(_mm256_slli_epi32(q, 3), _mm256_slli_epi32(q, 1));
+			_mm256_store_si256((__m256i*)column[i], _mm256_sub_epi32(x, ten_q));
+			x = q;
+		}
+
+		for (int j = 0; j < 8; j++)
+			for (int i = 0; i < 9; i++)
+				out[9 * j + i] = char('0' + column[i][j]);
+	}
+
+	to_chars_scalar(out, digits, n - m, 10, 9);
+}
+
+AP_TARGET_AVX2 inline void addmul_1_avx2(u64* acc, const int* b, int n, u32 k)
+{
+	const __m256i vk = _mm256_set1_epi64x(k);
+
+	int j = 0;
+	for (; j + 8 <= n; j += 8)
+	{
+		__m256i lo = _mm256_mul_epu32(_mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(b + j))), vk);
+		__m256i hi = _mm256_mul_epu32(_mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(b + j + 4))), vk);
+		_mm256_storeu_si256((__m256i*)(acc + j), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(acc + j)), lo));
+		_mm256_storeu_si256((__m256i*)(acc + j + 4), _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(acc + j + 4)), hi));
+	}
+
+	addmul_1_scalar(acc + j, b + j, n - j, k);
+}
+
+// As mont_mul_sse4.
+AP_TARGET_AVX2 inline __m256i mont_mul_avx2(__m256i a, __m256i b, __m256i p, __m256i neg_inv)
+{
+	__m256i t_even = _mm256_mul_epu32(a, b);
+	__m256i t_odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+	__m256i u_even = _mm256_add_epi64(t_even, _mm256_mul_epu32(_mm256_mul_epu32(t_even, neg_inv), p));
+	__m256i u_odd = _mm256_add_epi64(t_odd, _mm256_mul_epu32(_mm256_mul_epu32(t_odd, neg_inv), p));
+	__m256i u = _mm256_blend_epi32(_mm256_srli_epi64(u_even, 32), u_odd, 0xaa);
+	return _mm256_min_epu32(u, _mm256_sub_epi32(u, p));
+}
+
+AP_TARGET_AVX2 inline void ntt_dif_avx2(u32* a, int n, int len, int count, const u32* w, const Modulus& mod)
+{
+	if (count % 8)
+		return ntt_dif_scalar(a, n, len, count, w, mod);
+
+	const __m256i p = _mm256_set1_epi32(int(mod.p));
+	const __m256i neg_inv = _mm256_set1_epi32(int(mod.neg_inv));
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j += 8)
+		{
+			__m256i u = _mm256_loadu_si256((const __m256i*)(x + j));
+			__m256i v = _mm256_loadu_si256((const __m256i*)(y + j));
+			__m256i sum = _mm256_add_epi32(u, v);
+			__m256i diff = _mm256_sub_epi32(u, v);
+			_mm256_storeu_si256((__m256i*)(x + j), _mm256_min_epu32(sum, _mm256_sub_epi32(sum, p)));
+			diff = _mm256_min_epu32(diff, _mm256_add_epi32(diff, p));
+			_mm256_storeu_si256((__m256i*)(y + j), mont_mul_avx2(diff, _mm256_loadu_si256((const __m256i*)(w + j)), p, neg_inv));
+		}
+	}
+}
+
+AP_TARGET_AVX2 inline void ntt_dit_avx2(u32* a, int n, int len, int count, const u32* w, const Modulus& mod)
+{
+	if (count % 8)
+		return ntt_dit_scalar(a, n, len, count, w, mod);
+
+	const __m256i p = _mm256_set1_epi32(int(mod.p));
+	const __m256i neg_inv = _mm256_set1_epi32(int(mod.neg_inv));
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j += 8)
+		{
+			__m256i u = _mm256_loadu_si256((const __m256i*)(x + j));
+			__m256i v = mont_mul_avx2(_mm256_loadu_si256((const __m256i*)(y + j)), _mm256_loadu_si256((const __m256i*)(w + j)), p, neg_inv);
+			__m256i sum = _mm256_add_epi32(u, v);
+			__m256i diff = _mm256_sub_epi32(u, v);
+			_mm256_storeu_si256((__m256i*)(x + j), _mm256_min_epu32(sum, _mm256_sub_epi32(sum, p)));
+			_mm256_storeu_si256((__m256i*)(y + j), _mm256_min_epu32(diff, _mm256_add_epi32(diff, p)));
+		}
+	}
+}
+
+// GCC 12 flags the undefined pass-through operand of the unmasked AVX-512
+// intrinsics (cvtepu32_epi64, mul_epu32, ...) as maybe uninitialized.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+AP_TARGET_AVX512 inline int add_n_avx512(int* r, const int* a, const int* b, int n, int base, int carry)
+{
+	const __m512i top = _mm512_set1_epi32(base - 1);
+	const __m512i vbase = _mm512_set1_epi32(base);
+	const __m512i one = _mm512_set1_epi32(1);
+
+	int k = 0;
+	for (; k + 16 <= n; k += 16)
+	{
+		__m512i s = _mm512_add_epi32(_mm512_loadu_si512(a + k), _mm512_loadu_si512(b + k));
+		__mmask16 gen = _mm512_cmpgt_epi32_mask(s, top);
+		s = _mm512_mask_sub_epi32(s, gen, s, vbase);
+		__mmask16 prop = _mm512_cmpeq_epi32_mask(s, top);
+
+		unsigned sum = unsigned(gen | prop) + unsigned(gen) + unsigned(carry);
+		__mmask16 in = __mmask16((sum ^ prop) & 0xffff);
+		carry = int(sum >> 16);
+
+		s = _mm512_mask_add_epi32(s, in, s, one);
+		s = _mm512_mask_sub_epi32(s, _mm512_cmpeq_epi32_mask(s, vbase), s, vbase);
+		_mm512_storeu_si512(r + k, s);
+	}
+
+	return add_n_avx2(r + k, a + k, b + k, n - k, base, carry);
+}
+
+AP_TARGET_AVX512 inline int sub_n_avx512(int* r, const int* a, const int* b, int n, int base, int borrow)
+{
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i vbase = _mm512_set1_epi32(base);
+	const __m512i one = _mm512_set1_epi32(1);
+
+	int k = 0;
+	for (; k + 16 <= n; k += 16)
+	{
+		__m512i d = _mm512_sub_epi32(_mm512_loadu_si512(a + k), _mm512_loadu_si512(b + k));
+		__mmask16 gen = _mm512_cmplt_epi32_mask(d, zero);
+		d = _mm512_mask_add_epi32(d, gen, d, vbase);
+		__mmask16 prop = _mm512_cmpeq_epi32_mask(d, zero);
+
+		unsigned sum = unsigned(gen | prop) + unsigned(gen) + unsigned(borrow);
+		__mmask16 in = __mmask16((sum ^ prop) & 0xffff);
+		borrow = int(sum >> 16);
+
+		d = _mm512_mask_sub_epi32(d, in, d, one);
+		d = _mm512_mask_add_epi32(d, _mm512_cmplt_epi32_mask(d, zero), d, vbase);
+		_mm512_storeu_si512(r + k, d);
+	}
+
+	return sub_n_avx2(r + k, a + k, b + k, n - k, base, borrow);
+}
+
+// As mul_1_avx2, 8 products per 512-bit vector.
+AP_TARGET_AVX512 inline int mul_1_avx512(int* r, const int* a, int n, int k, int base)
+{
+	if (k > base)
+		return mul_1_scalar(r, a, n, k, base);
+
+	const __m512i vk = _mm512_set1_epi64(k);
+	const __m512i base64 = _mm512_set1_epi64(base);
+	const __m512i top64 = _mm512_set1_epi64(base - 1);
+	const __m512i one64 = _mm512_set1_epi64(1);
+	const __m512d ratio = _mm512_set1_pd(double(k) / double(base));
+	const __m256i top = _mm256_set1_epi32(base - 1);
+	const __m256i vbase = _mm256_set1_epi32(base);
+	const __m256i up = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+
+	int carry = 0;
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m512i product = _mm512_mul_epu32(_mm512_cvtepu32_epi64(x), vk);
+		__m512i quotient = _mm512_cvtepu32_epi64(_mm512_cvttpd_epi32(_mm512_mul_pd(_mm512_cvtepi32_pd(x), ratio)));
+		__m512i rest = _mm512_sub_epi64(product, _mm512_mul_epu32(quotient, base64));
+
+		__mmask8 under = _mm512_cmplt_epi64_mask(rest, _mm512_setzero_si512());
+		__mmask8 over = _mm512_cmpgt_epi64_mask(rest, top64);
+		rest = _mm512_mask_sub_epi64(_mm512_mask_add_epi64(rest, under, rest, base64), over, rest, base64);
+		quotient = _mm512_mask_add_epi64(_mm512_mask_sub_epi64(quotient, under, quotient, one64), over, quotient, one64);
+
+		__m256i q8 = _mm512_cvtepi64_epi32(quotient);
+		__m256i lo8 = _mm512_cvtepi64_epi32(rest);
+
+		int next = _mm256_extract_epi32(q8, 7);
+		__m256i shifted = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(q8, up), _mm256_set1_epi32(carry), 1);
+
+		int bit = 0;
+		__m256i digits = resolve_carries_avx2(_mm256_add_epi32(lo8, shifted), top, vbase, bit);
+		_mm256_storeu_si256((__m256i*)(r + i), digits);
+		carry = next + bit;
+	}
+
+	return mul_1_scalar(r + i, a + i, n - i, k, base, u64(carry));
+}
+
+AP_TARGET_AVX512 inline void addmul_1_avx512(u64* acc, const int* b, int n, u32 k)
+{
+	const __m512i vk = _mm512_set1_epi64(k);
+
+	int j = 0;
+	for (; j + 8 <= n; j += 8)
+	{
+		__m512i product = _mm512_mul_epu32(_mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i*)(b + j))), vk);
+		_mm512_storeu_si512(acc + j, _mm512_add_epi64(_mm512_loadu_si512(acc + j), product));
+	}
+
+	addmul_1_scalar(acc + j, b + j, n - j, k);
+}
+
+// As mont_mul_sse4.
+AP_TARGET_AVX512 inline __m512i mont_mul_avx512(__m512i a, __m512i b, __m512i p, __m512i neg_inv)
+{
+	__m512i t_even = _mm512_mul_epu32(a, b);
+	__m512i t_odd = _mm512_mul_epu32(_mm512_srli_epi64(a, 32), _mm512_srli_epi64(b, 32));
+	__m512i u_even = _mm512_add_epi64(t_even, _mm512_mul_epu32(_mm512_mul_epu32(t_even, neg_inv), p));
+	__m512i u_odd = _mm512_add_epi64(t_odd, _mm512_mul_epu32(_mm512_mul_epu32(t_odd, neg_inv), p));
+	__m512i u = _mm512_mask_blend_epi32(0xaaaa, _mm512_srli_epi64(u_even, 32), u_odd);
+	return _mm512_min_epu32(u, _mm512_sub_epi32(u, p));
+}
+
+AP_TARGET_AVX512 inline void ntt_dif_avx512(u32* a, int n, int len, int count, const u32* w, const Modulus& mod)
+{
+	if (count % 16)
+		return ntt_dif_avx2(a, n, len, count, w, mod);
+
+	const __m512i p = _mm512_set1_epi32(int(mod.p));
+	const __m512i neg_inv = _mm512_set1_epi32(int(mod.neg_inv));
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j += 16)
+		{
+			__m512i u = _mm512_loadu_si512(x + j);
+			__m512i v = _mm512_loadu_si512(y + j);
+			__m512i sum = _mm512_add_epi32(u, v);
+			__m512i diff = _mm512_sub_epi32(u, v);
+			_mm512_storeu_si512(x + j, _mm512_min_epu32(sum, _mm512_sub_epi32(sum, p)));
+			diff = _mm512_min_epu32(diff, _mm512_add_epi32(diff, p));
+			_mm512_storeu_si512(y + j, mont_mul_avx512(diff, _mm512_loadu_si512(w + j), p, neg_inv));
+		}
+	}
+}
+
+AP_TARGET_AVX512 inline void ntt_dit_avx512(u32* a, int n, int len, int count, const u32* w, const Modulus& mod)
+{
+	if (count % 16)
+		return ntt_dit_avx2(a, n, len, count, w, mod);
+
+	const __m512i p = _mm512_set1_epi32(int(mod.p));
+	const __m512i neg_inv = _mm512_set1_epi32(int(mod.neg_inv));
+	for (int s = 0; s < n; s += 2 * len)
+	{
+		u32* x = a + s;
+		u32* y = x + len;
+		for (int j = 0; j < count; j += 16)
+		{
+			__m512i u = _mm512_loadu_si512(x + j);
+			__m512i v = mont_mul_avx512(_mm512_loadu_si512(y + j), _mm512_loadu_si512(w + j), p, neg_inv);
+			__m512i sum = _mm512_add_epi32(u, v);
+			__m512i diff = _mm512_sub_epi32(u, v);
+			_mm512_storeu_si512(x + j, _mm512_min_epu32(sum, _mm512_sub_epi32(sum, p)));
+			_mm512_storeu_si512(y + j, _mm512_min_epu32(diff, _mm512_add_epi32(diff, p)));
+		}
+	}
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+struct Dispatch
+{
+	Cpu cpu;
+	int (*add_n)(int* r, const int* a, const int* b, int n, int base, int carry);
+	int (*sub_n)(int* r, const int* a, const int* b, int n, int base, int borrow);
+	int (*mul_1)(int* r, const int* a, int n, int k, int base);
+	void (*addmul_1)(u64* acc, const int* b, int n, u32 k);
+	void (*to_chars)(char* out, const int* digits, int n, int base, int width);
+	void (*ntt_dif)(u32* a, int n, int len, int count, const u32* w, const Modulus& mod);
+	void (*ntt_dit)(u32* a, int n, int len, int count, const u32* w, const Modulus& mod);
+};
+
+// The kernels of cpu, limited to what the running CPU has.
+inline Dispatch make_dispatch(Cpu cpu)
+{
+	Dispatch d{ Cpu::SCALAR, add_n_scalar, sub_n_scalar, [](int* r, const int* a, int n, int k, int base) { return mul_1_scalar(r, a, n, k, base); },
+		addmul_1_scalar, to_chars_scalar, ntt_dif_scalar, ntt_dit_scalar };
+
+#ifdef AP_NUMBER_SIMD
+	d.cpu = std::min(cpu, detect_cpu());
+	switch (d.cpu)
+	{
+	case Cpu::AVX512:
+		d = { Cpu::AVX512, add_n_avx512, sub_n_avx512, mul_1_avx512, addmul_1_avx512, to_chars_avx2, ntt_dif_avx512, ntt_dit_avx512 };
+		break;
+	case Cpu::AVX2:
+		d = { Cpu::AVX2, add_n_avx2, sub_n_avx2, mul_1_avx2, addmul_1_avx2, to_chars_avx2, ntt_dif_avx2, ntt_dit_avx2 };
+		break;
+	case Cpu::SSE4:
+		d.add_n = add_n_sse4;
+		d.sub_n = sub_n_sse4;
+		d.addmul_1 = addmul_1_sse4;
+		d.ntt_dif = ntt_dif_sse4;
+		d.ntt_dit = ntt_dit_sse4;
+		break;
+	default:
+		break;
+	}
+#endif
+	return d;
+}
+
+// The table in use, for the running CPU. Assign make_dispatch(...) to pin a lower level.
+inline Dispatch& dispatch()
+{
+	static Dispatch table = make_dispatch(Cpu::AVX512);
+	return table;
+}
+
+inline int add_n(int* r, const int* a, const int* b, int n, int base, int carry = 0)
+{
+	return n < 4 ? add_n_scalar(r, a, b, n, base, carry) : dispatch().add_n(r, a, b, n, base, carry);
+}
+
+inline int sub_n(int* r, const int* a, const int* b, int n, int base, int borrow = 0)
+{
+	return n < 4 ? sub_n_scalar(r, a, b, n, base, borrow) : dispatch().sub_n(r, a, b, n, base, borrow);
+}
+
+inline void to_chars(char* out, const int* digits, int n, int base, int width)
+{
+	dispatch().to_chars(out, digits, n, base, width);
+}
+
+// How many digit products can be added on a normalized digit without overflow of u64.
+inline int max_pending_products(int base)
+{
+	u64 max_digit = u64(base - 1);
+	u64 room = ~u64(0) - u64(base);
+	u64 count = room / std::max<u64>(max_digit * max_digit, 1);
+	return (int)std::min<u64>(count, 1 << 20);
+}
+
+// Propagate carries of acc[from, n) so that every digit is in [0, base).
+inline void normalize(u64* acc, int from, int n, int base)
+{
+	u64 carry = 0;
+	if (!(base & (base - 1)))
+	{
+		int bits = 0;
+		while ((1 << bits) < base)
+			bits++;
+
+		for (int k = from; k < n; k++)
+		{
+			u64 v = acc[k] + carry;
+			carry = v >> bits;
+			acc[k] = v & u64(base - 1);
+		}
+
+		assert(carry == 0);
+		return;
+	}
+
+	for (int k = from; k < n; k++)
+	{
+		u64 v = acc[k] + carry;
+		carry = v / u64(base);
+		acc[k] = v - carry * u64(base);
+	}
+
+	assert(carry == 0);
+}
+
+/*
+	r[0, na+nb) = a[0, na) * b[0, nb)
+
+	Columns below skip are not needed by the caller, they are neither
+	computed nor carried, and are left as 0 in r.
+
+	Products are summed into 64-bit accumulators, and the carries are only
+	resolved once every max_pending_products(base) rows.
+*/
+inline void mul_basecase(int* r, const int* a, int na, const int* b, int nb, int base, int skip = 0)
+{
+	// rows on the shorter one, the inner loop runs over the longer one.
+	if (na > nb)
+	{
+		std::swap(a, b);
+		std::swap(na, nb);
+	}
+
+	int n = na + nb;
+	skip = std::max(0, std::min(skip, n));
+
+	ScratchFrame frame;
+	u64* acc = frame.alloc_zero<u64>(size_t(n));
+	int pending_rows = max_pending_products(base);
+	auto addmul_1 = dispatch().addmul_1;
+
+	int rows = 0;
+	int lowest = n;
+	for (int i = 0; i < na; i++)
+	{
+		int j0 = std::max(0, skip - i);
+		if (j0 >= nb)
+			continue;
+
+		addmul_1(acc + i + j0, b + j0, nb - j0, u32(a[i]));
+
+		lowest = std::min(lowest, i + j0);
+		if (++rows == pending_rows)
+		{
+			normalize(acc, lowest, n, base);
+			rows = 0;
+			lowest = n;
+		}
+	}
+
+	if (rows)
+		normalize(acc, lowest, n, base);
+
+	for (int k = 0; k < n; k++)
+		r[k] = int(acc[k]);
+}
+
+/*
+	r[0, 2n) = a[0, n)^2
+
+	a^2 = 2 * sum(a_i * a_j, i < j) + sum(a_i^2), about half of the digit
+	products of mul_basecase. skip works as in mul_basecase.
+*/
+inline void sqr_basecase(int* r, const int* a, int n, int base, int skip = 0)
+{
+	int nr = 2 * n;
+	skip = std::max(0, std::min(skip, nr));
+
+	ScratchFrame frame;
+	u64* acc = frame.alloc_zero<u64>(size_t(nr));
+	int pending_rows = max_pending_products(base);
+	auto addmul_1 = dispatch().addmul_1;
+
+	// cross products a_i * a_j, i < j
+	int rows = 0;
+	int lowest = nr;
+	for (int i = 0; i < n; i++)
+	{
+		int j0 = std::max(i + 1, skip - i);
+		if (j0 >= n)
+			continue;
+
+		addmul_1(acc + i + j0, a + j0, n - j0, u32(a[i]));
+
+		lowest = std::min(lowest, i + j0);
+		if (++rows == pending_rows)
+		{
+			normalize(acc, lowest, nr, base);
+			rows = 0;
+			lowest = nr;
+		}
+	}
+
+	if (rows)
+		normalize(acc, lowest, nr, base);
+
+	// double the cross products, add the squares
+	u64 carry = 0;
+	for (int k = 0; k < nr; k++)
+	{
+		u64 v = 2 * acc[k] + carry;
+		if (!(k & 1) && k >= skip)
+			v += u64(a[k / 2]) * u64(a[k / 2]);
+
+		carry = v / u64(base);
+		r[k] = int(v - carry * u64(base));
+	}
+
+	assert(carry == 0);
+}
+
+// r[0, na) = a[0, na) + b[0, nb), na >= nb, return the carry out.
+inline int add(int* r, const int* a, int na, const int* b, int nb, int base)
+{
+	assert(na >= nb);
+
+	int carry = add_n(r, a, b, nb, base);
+	int k = nb;
+	for (; k < na && carry; k++)
+	{
+		carry = a[k] == base - 1;
+		r[k] = carry ? 0 : a[k] + 1;
+	}
+
+	if (r != a && k < na)
+		std::memmove(r + k, a + k, (na - k) * sizeof(int));
+
+	return carry;
+}
+
+// r[0, na) = a[0, na) - b[0, nb), na >= nb, return the borrow out.
+inline int sub(int* r, const int* a, int na, const int* b, int nb, int base)
+{
+	assert(na >= nb);
+
+	int borrow = sub_n(r, a, b, nb, base);
+	int k = nb;
+	for (; k < na && borrow; k++)
+	{
+		borrow = a[k] == 0;
+		r[k] = borrow ? base - 1 : a[k] - 1;
+	}
+
+	if (r != a && k < na)
+		std::memmove(r + k, a + k, (na - k) * sizeof(int));
+
+	return borrow;
+}
+
+// Compare a[0, n) with b[0, n).
+inline int compare(const int* a, const int* b, int n)
+{
+	while (n--)
+	{
+		if (a[n] != b[n])
+			return a[n] > b[n] ? 1 : -1;
+	}
+	return 0;
+}
+
+// r[0, n) = base^n - r[0, n), r != 0.
+inline void negate(int* r, int n, int base)
+{
+	int k = 0;
+	while (k < n && !r[k])
+		k++;
+
+	assert(k < n);
+	r[k] = base - r[k];
+	for (k++; k < n; k++)
+		r[k] = base - 1 - r[k];
+}
+
+// Length of a[0, n) without the leading zeros.
+inline int length(const int* a, int n)
+{
+	while (n > 0 && !a[n - 1])
+		n--;
+	return n;
+}
+
+inline void mul(int* r, const int* a, int na, const int* b, int nb, int base, int skip = 0);
+inline void sqr(int* r, const int* a, int n, int base, int skip = 0);
+
+// na >= 2 * nb: multiply b by slices of a of nb digits each.
+// With threads, the slice products are all made (as tasks) before they are added.
+inline void mul_unbalanced(int* r, const int* a, int na, const int* b, int nb, int base)
+{
+	std::fill(r, r + na + nb, 0);
+	ScratchFrame frame;
+
+	int slices = (na + nb - 1) / nb;
+	int batch = worth_forking(nb) ? slices : 1;
+	int* products = frame.alloc<int>(size_t(batch) * nb * 2);
+
+	for (int first = 0; first < slices; first += batch)
+	{
+		int count = std::min(batch, slices - first);
+		run_tasks(count, nb, [&](int i)
+		{
+			int offset = (first + i) * nb;
+			mul(products + size_t(i) * nb * 2, a + offset, std::min(nb, na - offset), b, nb, base);
+		});
+
+		for (int i = 0; i < count; i++)
+		{
+			int offset = (first + i) * nb;
+			int n = std::min(nb, na - offset);
+			int carry = add(r + offset, r + offset, n + nb, products + size_t(i) * nb * 2, n + nb, base);
+			assert(!carry);
+			(void)carry;
+		}
+	}
+}
+
+/*
+Karatsuba
+	a = a1 * B^m + a0, b = b1 * B^m + b0
+
+	a * b = a1*b1 * B^2m + ((a0+a1)*(b0+b1) - a0*b0 - a1*b1) * B^m + a0*b0
+
+	Three half-size products instead of four.
+	nb <= na < 2 * nb, so that b1 is not empty.
+
+	With a == b the three products are squares.
+*/
+inline void mul_karatsuba(int* r, const int* a, int na, const int* b, int nb, int base)
+{
+	int m = na / 2;
+	assert(nb > m);
+	bool square = a == b && na == nb;
+
+	const int* a0 = a, * a1 = a + m;
+	const int* b0 = b, * b1 = b + m;
+	int na1 = na - m, nb1 = nb - m;
+
+	// (a0 + a1) * (b0 + b1)
+	int nsa = na1 + 1, nsb = std::max(m, nb1) + 1;
+	ScratchFrame frame;
+	int* sa = frame.alloc<int>(size_t(nsa + nsb));
+	int* sb = sa + nsa;
+
+	sa[nsa - 1] = add(sa, a1, na1, a0, m, base);
+	if (square)
+		sb = sa;
+	else if (nb1 >= m)
+		sb[nsb - 1] = add(sb, b1, nb1, b0, m, base);
+	else
+		sb[nsb - 1] = add(sb, b0, m, b1, nb1, base);
+
+	int* z1 = frame.alloc_zero<int>(size_t(nsa + nsb));
+
+	// z0 = a0*b0 at r[0, 2m), z2 = a1*b1 at r[2m, na+nb), z1, independent of each other.
+	run_tasks(3, nb, [&](int i)
+	{
+		if (i == 0)
+			mul(r, a0, m, b0, m, base);
+		else if (i == 1)
+			mul(r + 2 * m, a1, na1, b1, nb1, base);
+		else
+			mul(z1, sa, length(sa, nsa), sb, length(sb, nsb), base);
+	});
+
+	// z1 -= z0 + z2
+	int nz1 = length(z1, nsa + nsb);
+	int borrow = sub(z1, z1, nz1, r, length(r, 2 * m), base);
+	borrow |= sub(z1, z1, nz1, r + 2 * m, length(r + 2 * m, na1 + nb1), base);
+	assert(!borrow);
+	(void)borrow;
+
+	nz1 = length(z1, nz1);
+	int carry = add(r + m, r + m, na + nb - m, z1, nz1, base);
+	assert(!carry);
+	(void)carry;
+}
+
+/*
+Toom-Cook
+	Signed values for evaluation/interpolation: digits of the magnitude + sign.
+	The digits are in the workspace, inside the ScratchFrame of the product.
+*/
+struct SignedDigits
+{
+	std::pmr::vector<int> digits{ &Workspace::local() };
+	bool neg = false;
+
+	SignedDigits() = default;
+	SignedDigits(const int* a, int n) : digits(a, a + length(a, n), &Workspace::local()) {}
+	SignedDigits(const SignedDigits& x) : digits(x.digits, &Workspace::local()), neg{ x.neg } {}
+	SignedDigits(SignedDigits&&) = default;
+	SignedDigits& operator = (const SignedDigits&) = default;
+	SignedDigits& operator = (SignedDigits&&) = default;
+
+	int size() const { return (int)digits.size(); }
+	const int* data() const { return digits.data(); }
+
+	void trim() { digits.resize(size_t(length(digits.data(), size()))); if (digits.empty()) neg = false; }
+};
+
+// x + y, or x - y when subtract.
+inline SignedDigits signed_add(const SignedDigits& x, const SignedDigits& y, int base, bool subtract = false)
+{
+	bool y_neg = y.neg != subtract;
+	const SignedDigits* big = &x;
+	const SignedDigits* small = &y;
+
+	SignedDigits r;
+	if (x.neg == y_neg)
+	{
+		if (x.size() < y.size())
+			std::swap(big, small);
+
+		r.digits.resize(size_t(big->size() + 1));
+		r.digits.back() = add(r.digits.data(), big->data(), big->size(), small->data(), small->size(), base);
+		r.neg = x.neg;
+	}
+	else
+	{
+		bool x_bigger = x.size() != y.size() ? x.size() > y.size() : compare(x.data(), y.data(), x.size()) >= 0;
+		if (!x_bigger)
+			std::swap(big, small);
+
+		r.digits.resize(size_t(big->size()));
+		sub(r.digits.data(), big->data(), big->size(), small->data(), small->size(), base);
+		r.neg = x_bigger ? x.neg : y_neg;
+	}
+
+	r.trim();
+	return r;
+}
+
+// x *= k, k small.
+inline void signed_mul_1(SignedDigits& x, int k, int base)
+{
+	u64 carry = 0;
+	for (int& digit : x.digits)
+	{
+		u64 v = u64(digit) * u64(k) + carry;
+		carry = v / u64(base);
+		digit = int(v - carry * u64(base));
+	}
+
+	for (; carry; carry /= u64(base))
+		x.digits.push_back(int(carry % u64(base)));
+}
+
+// x /= k, x must be a multiple of k.
+inline void signed_divexact_1(SignedDigits& x, int k, int base)
+{
+	u64 rem = 0;
+	for (int i = x.size() - 1; i >= 0; i--)
+	{
+		u64 v = rem * u64(base) + u64(x.digits[size_t(i)]);
+		x.digits[size_t(i)] = int(v / u64(k));
+		rem = v % u64(k);
+	}
+
+	assert(rem == 0);
+	x.trim();
+}
+
+struct SignedProduct
+{
+	SignedDigits* r;
+	const SignedDigits* x;
+	const SignedDigits* y;
+};
+
+// *r = *x * *y for each of the products, as tasks for large operands. The results stay on the caller's workspace.
+inline void signed_mul_all(std::initializer_list<SignedProduct> products, int digits, int base)
+{
+	for (auto& product : products)
+	{
+		product.r->digits.assign(product.x->size() && product.y->size() ? size_t(product.x->size() + product.y->size()) : 0, 0);
+		product.r->neg = product.x->neg != product.y->neg;
+	}
+
+	run_tasks(int(products.size()), digits, [&](int i)
+	{
+		const SignedProduct& product = products.begin()[i];
+		if (product.r->size())
+			mul(product.r->digits.data(), product.x->data(), product.x->size(), product.y->data(), product.y->size(), base);
+	});
+
+	for (auto& product : products)
+		product.r->trim();
+}
+
+// r[offset, nr) += x, x >= 0.
+inline void add_at(int* r, int nr, int offset, const SignedDigits& x, int base)
+{
+	assert(!x.neg);
+	if (!x.size())
+		return;
+
+	int carry = add(r + offset, r + offset, nr - offset, x.data(), x.size(), base);
+	assert(!carry);
+	(void)carry;
+}
+
+/*
+Toom-3
+	a = a2*X^2 + a1*X + a0, b = b2*X^2 + b1*X + b0, X = B^k
+
+	Evaluate at 0, 1, -1, -2, inf, five products of 1/3 size instead of
+	nine (five squares when a == b), and interpolate the 5 coefficients
+	(Bodrato's sequence):
+
+		r3 = (r(-2) - r(1)) / 3
+		r1 = (r(1) - r(-1)) / 2
+		r2 = r(-1) - r(0)
+		r3 = (r2 - r3) / 2 + 2 * r(inf)
+		r2 = r2 + r1 - r(inf)
+		r1 = r1 - r3
+*/
+inline void mul_toom3(int* r, const int* a, int na, const int* b, int nb, int base)
+{
+	int k = (na + 2) / 3;
+	assert(nb > 2 * k);
+	bool square = a == b && na == nb;
+
+	ScratchFrame frame;
+	SignedDigits a0{ a, k }, a1{ a + k, k }, a2{ a + 2 * k, na - 2 * k };
+	SignedDigits b0, b1, b2;
+	if (!square)
+	{
+		b0 = SignedDigits{ b, k };
+		b1 = SignedDigits{ b + k, k };
+		b2 = SignedDigits{ b + 2 * k, nb - 2 * k };
+	}
+
+	auto eval = [base](const SignedDigits& x0, const SignedDigits& x1, const SignedDigits& x2, SignedDigits& at_1, SignedDigits& at_m1, SignedDigits& at_m2)
+	{
+		SignedDigits even = signed_add(x0, x2, base);
+		at_1 = signed_add(even, x1, base);
+		at_m1 = signed_add(even, x1, base, true);
+
+		// x0 - 2*x1 + 4*x2 = 2 * (x(-1) + x2) - x0
+		at_m2 = signed_add(at_m1, x2, base);
+		signed_mul_1(at_m2, 2, base);
+		at_m2 = signed_add(at_m2, x0, base, true);
+	};
+
+	SignedDigits pa1, pam1, pam2, pb1, pbm1, pbm2;
+	eval(a0, a1, a2, pa1, pam1, pam2);
+	if (!square)
+		eval(b0, b1, b2, pb1, pbm1, pbm2);
+
+	// x * x goes to sqr(), see signed_mul_all.
+	auto pick = [square](const SignedDigits& x, const SignedDigits& y) -> const SignedDigits& { return square ? x : y; };
+
+	SignedDigits r0, r1, rm1, rm2, rinf;
+	signed_mul_all({ { &r0, &a0, &pick(a0, b0) }, { &r1, &pa1, &pick(pa1, pb1) }, { &rm1, &pam1, &pick(pam1, pbm1) },
+		{ &rm2, &pam2, &pick(pam2, pbm2) }, { &rinf, &a2, &pick(a2, b2) } }, nb, base);
+
+	SignedDigits r3 = signed_add(rm2, r1, base, true);
+	signed_divexact_1(r3, 3, base);
+
+	r1 = signed_add(r1, rm1, base, true);
+	signed_divexact_1(r1, 2, base);
+
+	SignedDigits r2 = signed_add(rm1, r0, base, true);
+
+	r3 = signed_add(r2, r3, base, true);
+	signed_divexact_1(r3, 2, base);
+	SignedDigits rinf2 = rinf;
+	signed_mul_1(rinf2, 2, base);
+	r3 = signed_add(r3, rinf2, base);
+
+	r2 = signed_add(r2, r1, base);
+	r2 = signed_add(r2, rinf, base, true);
+
+	r1 = signed_add(r1, r3, base, true);
+
+	int nr = na + nb;
+	std::fill(r, r + nr, 0);
+	add_at(r, nr, 0, r0, base);
+	add_at(r, nr, k, r1, base);
+	add_at(r, nr, 2 * k, r2, base);
+	add_at(r, nr, 3 * k, r3, base);
+	add_at(r, nr, 4 * k, rinf, base);
+}
+
+/*
+Toom-3/2, for 3 * nb / 2 <= na < 2 * nb
+	a = a2*X^2 + a1*X + a0, b = b1*X + b0, X = B^k
+
+	Evaluate at 0, 1, -1, inf, four products:
+
+		c0 = r(0), c3 = r(inf)
+		c1 = (r(1) - r(-1)) / 2 - c3
+		c2 = (r(1) + r(-1)) / 2 - c0
+*/
+inline void mul_toom32(int* r, const int* a, int na, const int* b, int nb, int base)
+{
+	int k = std::max((na + 2) / 3, (nb + 1) / 2);
+	assert(na > 2 * k && nb > k);
+
+	ScratchFrame frame;
+	SignedDigits a0{ a, k }, a1{ a + k, k }, a2{ a + 2 * k, na - 2 * k };
+	SignedDigits b0{ b, k }, b1{ b + k, nb - k };
+
+	SignedDigits even = signed_add(a0, a2, base);
+	SignedDigits pa1 = signed_add(even, a1, base);
+	SignedDigits pam1 = signed_add(even, a1, base, true);
+	SignedDigits pb1 = signed_add(b0, b1, base);
+	SignedDigits pbm1 = signed_add(b0, b1, base, true);
+
+	SignedDigits r0, r1, rm1, rinf;
+	signed_mul_all({ { &r0, &a0, &b0 }, { &r1, &pa1, &pb1 }, { &rm1, &pam1, &pbm1 }, { &rinf, &a2, &b1 } }, nb, base);
+
+	SignedDigits c1 = signed_add(r1, rm1, base, true);
+	signed_divexact_1(c1, 2, base);
+	c1 = signed_add(c1, rinf, base, true);
+
+	SignedDigits c2 = signed_add(r1, rm1, base);
+	signed_divexact_1(c2, 2, base);
+	c2 = signed_add(c2, r0, base, true);
+
+	int nr = na + nb;
+	std::fill(r, r + nr, 0);
+	add_at(r, nr, 0, r0, base);
+	add_at(r, nr, k, c1, base);
+	add_at(r, nr, 2 * k, c2, base);
+	add_at(r, nr, 3 * k, rinf, base);
+}
+
+/*
+NTT
+	Number theoretic transform over three primes p = k * 2^n + 1 < 2^31,
+	the convolution is recombined with CRT.
+
+	A column of the product sums at most 2^26 digit products of 60 bits,
+	far below p0 * p1 * p2 ~ 2^90, so the convolution is exact for any base.
+*/
+inline u32 pow_mod(u32 a, u64 exp, u32 p)
+{
+	u64 result = 1, x = a % p;
+	for (; exp; exp >>= 1, x = x * x % p)
+	{
+		if (exp & 1)
+			result = result * x % p;
+	}
+	return u32(result);
+}
+
+struct NttPrime
+{
+	u32 p;
+	u32 root;		// primitive root of p
+	int max_log;	// p - 1 = k * 2^max_log
+};
+
+inline const NttPrime NTT_PRIMES[3] = { { 2013265921, 31, 27 }, { 1811939329, 13, 26 }, { 469762049, 3, 26 } };
+inline const int NTT_MAX_LOG = 26;
+
+
+// roots[len + j] = w^j (Montgomery form), w: primitive 2len-th root of unity, for len = 1, 2, 4 ... n/2.
+inline void ntt_roots(u32* roots, int n, const NttPrime& prime, const Modulus& mod, bool inverse)
+{
+	for (int len = 1; len < n; len *= 2)
+	{
+		u32 w = pow_mod(prime.root, (prime.p - 1) / (2 * len), prime.p);
+		if (inverse)
+			w = pow_mod(w, prime.p - 2, prime.p);
+
+		u32 w_mont = mod.to_mont(w);
+		roots[len] = mod.to_mont(1);
+		for (int j = 1; j < len; j++)
+			roots[len + j] = mod.mul(roots[len + j - 1], w_mont);
+	}
+}
+
+using NttLayer = void (*)(u32* a, int n, int len, int count, const u32* w, const Modulus& mod);
+
+// One layer as tasks, runs of whole blocks while there are enough blocks, else slices of each block.
+inline void ntt_layer(NttLayer layer, u32* a, int n, int len, const u32* w, const Modulus& mod, int digits)
+{
+	int tasks = worth_forking(digits) ? current_executor().concurrency() : 1;
+	int blocks = n / (2 * len);
+	if (blocks >= tasks)
+	{
+		return run_tasks(tasks, digits, [&](int t)
+		{
+			int from = int(u64(blocks) * t / tasks), to = int(u64(blocks) * (t + 1) / tasks);
+			if (from < to)
+				layer(a + 2 * len * from, 2 * len * (to - from), len, len, w, mod);
+		});
+	}
+
+	// slices of 16 butterflies multiples, so that the vector kernels take them whole.
+	int slices = tasks / blocks;
+	int slice = (len / slices + 15) & ~15;
+	run_tasks(blocks * slices, digits, [&](int t)
+	{
+		int block = t / slices, from = std::min(len, t % slices * slice), to = std::min(len, from + slice);
+		if (from < to)
+			layer(a + 2 * len * block + from, 2 * len, len, to - from, w + from, mod);
+	});
+}
+
+// Decimation in frequency, natural order in, bit-reversed order out.
+// digits: operand size, decides whether the layers are split into tasks.
+inline void ntt_forward(u32* a, int n, const u32* roots, const Modulus& mod, int digits)
+{
+	auto layer = dispatch().ntt_dif;
+	for (int len = n / 2; len >= 1; len /= 2)
+		ntt_layer(layer, a, n, len, roots + len, mod, digits);
+}
+
+// Decimation in time, bit-reversed order in, natural order out (not scaled by 1/n).
+inline void ntt_inverse(u32* a, int n, const u32* roots, const Modulus& mod, int digits)
+{
+	auto layer = dispatch().ntt_dit;
+	for (int len = 1; len < n; len *= 2)
+		ntt_layer(layer, a, n, len, roots + len, mod, digits);
+}
+
+// c[0, n) = cyclic convolution of a and b modulo prime, b == nullptr for a * a.
+inline void ntt_convolution(u32* c, const int* a, int na, const int* b, int nb, int n, const NttPrime& prime)
+{
+	Modulus mod{ prime.p };
+	ScratchFrame frame;
+	u32* roots = frame.alloc<u32>(size_t(n) * 2);
+
+	ntt_roots(roots, n, prime, mod, false);
+	ntt_roots(roots + n, n, prime, mod, true);
+
+	auto load = [&](u32* x, const int* digits, int count)
+	{
+		for (int k = 0; k < count; k++)
+			x[k] = u32(digits[k]) % prime.p;
+		std::fill(x + count, x + n, 0);
+		ntt_forward(x, n, roots, mod, nb);
+	};
+
+	load(c, a, na);
+	if (b)
+	{
+		u32* fb = frame.alloc<u32>(size_t(n));
+		load(fb, b, nb);
+		for (int k = 0; k < n; k++)
+			c[k] = mod.mul(c[k], fb[k]);
+	}
+	else
+	{
+		for (int k = 0; k < n; k++)
+			c[k] = mod.mul(c[k], c[k]);
+	}
+
+	ntt_inverse(c, n, roots + n, mod, nb);
+
+	// c * R^-1 from the pointwise product, then * n^-1 * R^2 => c / n
+	u32 scale = mod.to_mont(mod.to_mont(pow_mod(u32(n), prime.p - 2, prime.p)));
+	for (int k = 0; k < n; k++)
+		c[k] = mod.mul(c[k], scale);
+}
+
+// Divide the 128-bit value {hi, lo} by base in place, return the remainder.
+inline int divmod_128(u64& hi, u64& lo, int base)
+{
+	u64 words[4] = { hi >> 32, hi & 0xffffffff, lo >> 32, lo & 0xffffffff };
+	u64 rem = 0;
+	for (auto& word : words)
+	{
+		u64 cur = (rem << 32) | word;
+		word = cur / u64(base);
+		rem = cur - word * u64(base);
+	}
+
+	hi = (words[0] << 32) | words[1];
+	lo = (words[2] << 32) | words[3];
+	return int(rem);
+}
+
+// r[0, na+nb) = a * b with NTT, b == nullptr for a * a.
+inline void mul_ntt(int* r, const int* a, int na, const int* b, int nb, int base)
+{
+	int nr = na + nb;
+	int log_n = 0;
+	while ((1 << log_n) < nr - 1)
+		log_n++;
+
+	assert(log_n <= NTT_MAX_LOG);
+	int n = 1 << log_n;
+
+	ScratchFrame frame;
+	u32* residues = frame.alloc<u32>(size_t(n) * 3);
+	u32* c[3] = { residues, residues + n, residues + 2 * n };
+	run_tasks(3, nb, [&](int i) { ntt_convolution(c[i], a, na, b, nb, n, NTT_PRIMES[i]); });
+
+	// Garner: x = c0 + p0 * t1 + p0 * p1 * t2
+	const u64 p0 = NTT_PRIMES[0].p, p1 = NTT_PRIMES[1].p, p2 = NTT_PRIMES[2].p;
+	const u64 p0p1 = p0 * p1;
+	const u64 inv_p0 = pow_mod(u32(p0 % p1), p1 - 2, u32(p1));
+	const u64 inv_p0p1 = pow_mod(u32(p0p1 % p2), p2 - 2, u32(p2));
+
+	u64 carry_hi = 0, carry_lo = 0;
+	for (int k = 0; k < nr; k++)
+	{
+		u64 lo = 0, hi = 0;
+		if (k < n)
+		{
+			u64 c0 = c[0][k], c1 = c[1][k], c2 = c[2][k];
+			u64 t1 = (c1 + p1 - c0 % p1) % p1 * inv_p0 % p1;
+			u64 x01 = c0 + p0 * t1;
+			u64 t2 = (c2 + p2 - x01 % p2) % p2 * inv_p0p1 % p2;
+
+			// p0p1 * t2 = (p0p1_hi * 2^32 + p0p1_lo) * t2
+			u64 m_lo = (p0p1 & 0xffffffff) * t2;
+			u64 m_hi = (p0p1 >> 32) * t2;
+			lo = m_lo + (m_hi << 32);
+			hi = (m_hi >> 32) + (lo < m_lo);
+
+			lo += x01;
+			hi += lo < x01;
+		}
+
+		carry_lo += lo;
+		carry_hi += hi + (carry_lo < lo);
+		r[k] = divmod_128(carry_hi, carry_lo, base);
+	}
+
+	assert(carry_hi == 0 && carry_lo == 0);
+}
+
+// Toom-3 for na >= nb from MUL_TOOM3_THRESHOLD, while b fills the three parts and the
+// evaluated parts (up to k + 2 digits) stay shorter than b, so the recursion ends.
+inline bool use_toom3(int na, int nb)
+{
+	int k = (na + 2) / 3;
+	return nb >= MUL_TOOM3_THRESHOLD && nb > 2 * k && k + 2 < nb;
+}
+
+/*
+	r[0, na+nb) = a[0, na) * b[0, nb)
+
+	Pick the algorithm by operand sizes. skip is a hint for the schoolbook
+	product, columns below skip may be left out (see mul_basecase).
+*/
+inline void mul(int* r, const int* a, int na, const int* b, int nb, int base, int skip)
+{
+	if (a == b && na == nb)
+		return sqr(r, a, na, base, skip);
+
+	if (na < nb)
+	{
+		std::swap(a, b);
+		std::swap(na, nb);
+	}
+
+	if (nb < MUL_KARATSUBA_THRESHOLD)
+		return mul_basecase(r, a, na, b, nb, base, skip);
+
+	if (nb >= MUL_NTT_THRESHOLD && na + nb <= (1 << NTT_MAX_LOG))
+		return mul_ntt(r, a, na, a == b && na == nb ? nullptr : b, nb, base);
+
+	if (na >= 2 * nb)
+		return mul_unbalanced(r, a, na, b, nb, base);
+
+	if (2 * na >= 3 * nb)
+		return mul_toom32(r, a, na, b, nb, base);
+
+	if (use_toom3(na, nb))
+		return mul_toom3(r, a, na, b, nb, base);
+
+	mul_karatsuba(r, a, na, b, nb, base);
+}
+
+// r[0, 2n) = a[0, n)^2, the squaring counterpart of every mul() algorithm.
+inline void sqr(int* r, const int* a, int n, int base, int skip)
+{
+	if (n < MUL_KARATSUBA_THRESHOLD)
+		return sqr_basecase(r, a, n, base, skip);
+
+	if (n >= MUL_NTT_THRESHOLD && 2 * n <= (1 << NTT_MAX_LOG))
+		return mul_ntt(r, a, n, nullptr, n, base);
+
+	if (use_toom3(n, n))
+		return mul_toom3(r, a, n, a, n, base);
+
+	mul_karatsuba(r, a, n, a, n, base);
+}
+
+// r[0, n) = a[0, n) * k, k < base, return the carry out.
+inline int mul_1(int* r, const int* a, int n, int k, int base)
+{
+	return n < 8 ? mul_1_scalar(r, a, n, k, base) : dispatch().mul_1(r, a, n, k, base);
+}
+
+// High 64 bits of a * b.
+inline u64 mul_hi(u64 a, u64 b)
+{
+#if defined(__SIZEOF_INT128__)
+	return u64((unsigned __int128)a * b >> 64);
+#else
+	u64 a_lo = a & 0xffffffff, a_hi = a >> 32;
+	u64 b_lo = b & 0xffffffff, b_hi = b >> 32;
+
+	u64 lo_lo = a_lo * b_lo;
+	u64 mid_1 = a_hi * b_lo + (lo_lo >> 32);
+	u64 mid_2 = a_lo * b_hi + (mid_1 & 0xffffffff);
+	return a_hi * b_hi + (mid_1 >> 32) + (mid_2 >> 32);
+#endif
+}
 
-namespace ArbitraryPrecision {
+/*
+	Division by a divisor fixed for a whole pass: the hardware division
+	is replaced by a multiplication with inv = floor((2^64 - 1) / d).
+
+	q~ = mul_hi(n, inv) never exceeds n / d and misses it by at most 2,
+	a couple of subtractions fix it up.
+*/
+struct ShortDivisor
+{
+	u64 d;
+	u64 inv;
+
+	explicit ShortDivisor(u64 divisor) : d{ divisor }, inv{ ~u64(0) / divisor } {}
+
+	// q = n / d, return n % d.
+	u64 divrem(u64 n, u64& q) const
+	{
+		q = mul_hi(n, inv);
+		u64 r = n - q * d;
+		while (r >= d)
+		{
+			q++;
+			r -= d;
+		}
+
+		return r;
+	}
+};
+
+// q[0, n) = a[0, n) / k, return the remainder. k * base must fit in u64.
+inline u64 divrem_1(int* q, const int* a, int n, u64 k, int base)
+{
+	ShortDivisor divisor{ k };
+	u64 rem = 0;
+	for (int i = n - 1; i >= 0; i--)
+	{
+		u64 digit;
+		rem = divisor.divrem(rem * u64(base) + u64(a[i]), digit);
+		q[i] = int(digit);
+	}
+
+	return rem;
+}
+
+/*
+	a[0, n) = a[0, n) * num / den truncated, return the remainder.
+	(num + den) * base must fit in u64, the top digits of a must leave
+	room for the product.
+
+	One pass from the top: the dividend digits are a[k] * num, so the
+	quotient digits may reach past base; their carries go back up into
+	the digits already done.
+*/
+inline u64 mul_divrem_1(int* a, int n, u64 num, u64 den, int base)
+{
+	const ShortDivisor by_den{ den };
+	const ShortDivisor by_base{ u64(base) };
+
+	u64 rem = 0;
+	for (int k = n - 1; k >= 0; k--)
+	{
+		u64 q;
+		rem = by_den.divrem(rem * u64(base) + u64(a[k]) * num, q);
+
+		u64 carry;
+		a[k] = int(by_base.divrem(q, carry));
+		for (int i = k + 1; carry; i++)
+		{
+			assert(i < n);
+			u64 digit = u64(a[i]) + carry;
+			a[i] = int(by_base.divrem(digit, carry));
+		}
+	}
+
+	return rem;
+}
+
+/*
+	q[0, nu-nv+1) = u[0, nu) / v[0, nv), nu >= nv, v[nv-1] != 0.
+
+	Knuth's Algorithm D. u needs room for nu + 1 digits, it is left with
+	the remainder in u[0, nv) and zeros above. v is scaled in place while
+	dividing and restored afterwards.
+
+	Once v[nv-1] >= base / 2, the trial digit from the top two digits of u
+	and v is at most 2 too big; checking it on the third digit leaves at
+	most one add-back, which is rare.
+*/
+inline void divrem(int* q, int* u, int nu, int* v, int nv, int base)
+{
+	assert(nu >= nv && nv > 0 && v[nv - 1]);
+
+	if (nv == 1)
+	{
+		u[0] = int(divrem_1(q, u, nu, u64(v[0]), base));
+		std::fill(u + 1, u + nu + 1, 0);
+		return;
+	}
+
+	int scale = base / (v[nv - 1] + 1);
+	u[nu] = mul_1(u, u, nu, scale, base);
+	int carry_v = mul_1(v, v, nv, scale, base);
+	assert(!carry_v && 2 * v[nv - 1] >= base - 1);
+	(void)carry_v;
+
+	const u64 B = u64(base);
+	const u64 v1 = u64(v[nv - 1]), v2 = u64(v[nv - 2]);
+	const ShortDivisor by_base{ B };
+	for (int j = nu - nv; j >= 0; j--)
+	{
+		int* w = u + j;
+
+		u64 top = u64(w[nv]) * B + u64(w[nv - 1]);
+		u64 q_hat = top / v1;
+		u64 r_hat = top - q_hat * v1;
+		while (q_hat >= B || q_hat * v2 > r_hat * B + u64(w[nv - 2]))
+		{
+			q_hat--;
+			r_hat += v1;
+			if (r_hat >= B)
+				break;
+		}
+
+		// w[0, nv] -= q_hat * v
+		u64 carry = 0;
+		int borrow = 0;
+		for (int i = 0; i < nv; i++)
+		{
+			u64 p = q_hat * u64(v[i]) + carry;
+			int low = int(by_base.divrem(p, carry));
+			int digit = w[i] - low - borrow;
+			borrow = digit < 0;
+			w[i] = borrow ? digit + base : digit;
+		}
+
+		int top_digit = w[nv] - int(carry) - borrow;
+		if (top_digit < 0)
+		{
+			q_hat--;
+			top_digit += add(w, w, nv, v, nv, base);
+		}
+
+		assert(top_digit == 0);
+		w[nv] = 0;
+		q[j] = int(q_hat);
+	}
+
+	u64 rem = divrem_1(u, u, nv, u64(scale), base);
+	assert(!rem);
+	rem = divrem_1(v, v, nv, u64(scale), base);
+	assert(!rem);
+	(void)rem;
+}
+
+}
+
+class Number;
+
+// One term of a fused sum: (-1)^neg * x * y, or (-1)^neg * x without y.
+struct ProductTerm
+{
+	const Number* x;
+	const Number* y;
+	bool neg;
+};
+
+namespace Expr {
+template<int N> struct Sum;
+template<int N> struct Quot;
+}
 
 class Number
 {
 
 public:
-	static const int DEFAULT_BASE = 640000000;
+	static const int DEFAULT_BASE = AP_NUMBER_DEFAULT_BASE;
+	static const int DECIMAL_BASE = 1000000000;
+	static const int BINARY_BASE = 1 << 30;
 	static const int DEFAULT_PRECISION_IN_10 = 2000;
 
 	inline static const double EXTRA_PRECISION = 0.1;
@@ -27,17 +2791,21 @@ protected:
 	enum class BasePrecision { V };
 
 	int _base;
+	int _base_bits;		// log2(_base) for a power of 2 base (carries are shifts), else 0
 	int _ms_exp;
+	bool _neg;			// sign, the digits are the magnitude, all in [0, _base)
 	double _precision;
 	int _safe_precision;
 
-	std::deque<int> _digits;
+	DigitBuffer _digits;
 
 	template<class T>
 	Number(BasePrecision, T value, double precision_in_base, int new_base)
 		:
 		_base{ new_base },
+		_base_bits{ cal_base_bits(_base) },
 		_ms_exp{ 0 },
+		_neg{ false },
 		_precision{ precision_in_base },
 		_safe_precision{ cal_safe_precision() },
 		_digits{ 0 }
@@ -49,7 +2817,9 @@ protected:
 	Number(PatternNew, T value, const Number& pattern)
 		:
 		_base{ pattern._base },
+		_base_bits{ cal_base_bits(_base) },
 		_ms_exp{ 0 },
+		_neg{ false },
 		_precision{ pattern._precision },
 		_safe_precision{ pattern._safe_precision },
 		_digits{ 0 }
@@ -73,7 +2843,9 @@ public:
 	Number(T value, int precision_in_10, int base)
 		:
 		_base{ base },
+		_base_bits{ cal_base_bits(_base) },
 		_ms_exp{ 0 },
+		_neg{ false },
 		_precision{ cal_precision(precision_in_10) },
 		_safe_precision{ cal_safe_precision() },
 		_digits{ 0 }
@@ -86,6 +2858,10 @@ public:
 	template<class T> Number(T value, int precision_in_10) : Number(value, precision_in_10, DEFAULT_BASE) {}
 	template<class T> Number pattern_new(T x) const { return Number(PatternNew::V, x, *this); }
 
+	// Fused expressions (namespace Expr) take the base and precision of their first operand.
+	template<int N> Number(const Expr::Sum<N>& expr) : Number(PatternNew::V, 0, *expr.terms[0].x) { assign_products(expr.terms, N); }
+	template<int N> Number(const Expr::Quot<N>& expr) : Number(PatternNew::V, 0, *expr.num.terms[0].x) { assign_quotient(expr.num.terms, N, *expr.den); }
+
 	int get_base() const { return _base; }
 	int get_precision_in_10() const { return (int)std::round(_precision * std::log10(_base) / std::log10(10)); }
 
@@ -98,8 +2874,8 @@ public:
 	int min_exp() const { return -_safe_precision; }
 	int min_comp_exp() const { return -(int)std::ceil(_precision); }
 
-	int& ms_digit() { return _digits.front(); }
-	int& ls_digit() { return _digits.back(); }
+	int& ms_digit() { return _digits.back(); }
+	int& ls_digit() { return _digits.front(); }
 
 	int& most_significant_digit() { return ms_digit(); }
 	int& least_significant_digit() { return ls_digit(); }
@@ -110,16 +2886,16 @@ public:
 	int most_significant_value() const { return ms_value(); }
 	int least_significant_value() const { return ls_value(); }
 
-	bool is_one() const { return _digits.size() == 1 && ms_value() == 1; }
+	bool is_one() const { return _digits.size() == 1 && ms_value() == 1 && !_neg; }
 	bool is_zero() const { return ms_exp() < min_comp_exp() || is_zero_strict(); }
 	bool is_not_zero() const { return !is_zero(); }
 
 	bool is_zero_strict() const { return ms_value() == 0; }
 	bool is_not_zero_strict() const { return !is_zero_strict(); }
 
-	bool is_positive() const { return ms_value() > 0; }
-	bool is_non_neg() const { return ms_value() >= 0; }
-	bool is_negative() const { return !is_non_neg(); }
+	bool is_positive() const { return !_neg && ms_value() > 0; }
+	bool is_non_neg() const { return !_neg; }
+	bool is_negative() const { return _neg; }
 
 	int operator () (int exp) const { return digit_value(exp); }
 	int& operator [] (int exp) { return get_digit(exp); }
@@ -131,12 +2907,15 @@ public:
 	template<class T> bool operator != (const T cmp_no) { return get_relation(cmp_no) != 0; }
 	template<class T> bool operator == (const T cmp_no) const { return get_relation(cmp_no) == 0; }
 
-	Number  operator - () const { return (*this) * -1; }
+	Number  operator - () const & { Number no{ *this }; no.mul_minus_1(); return no; }
+	Number  operator - () && { mul_minus_1(); return std::move(*this); }
 	Number& operator + () { return *this; }
 	Number& operator <<= (int shifts) { _ms_exp += shifts; return *this; }
 	Number& operator >>= (int shifts) { _ms_exp -= shifts; return *this; }
 
 	template <class T> Number& operator  = (T value) { clear(); return *this += value; }
+	template<int N> Number& operator = (const Expr::Sum<N>& expr) { return assign_products(expr.terms, N); }
+	template<int N> Number& operator = (const Expr::Quot<N>& expr) { return assign_quotient(expr.num.terms, N, *expr.den); }
 	template <class T> Number& operator -= (T no) { return (*this) += (-no); }
 	template <class T> Number& operator += (T value) { return add_equ(value); }
 	template <class T> Number& operator ^= (T exp) { return power_equ(exp); }
@@ -157,16 +2936,61 @@ public:
 	Number& operator *= (double value) { return mul_equ(pattern_new(value)); }
 
 	Number& operator /= (int value) { return div_equ(value); }
+	Number& operator /= (long long value) { return div_equ(value); }
 	Number& operator /= (double value) { return div_equ(pattern_new(value)); }
 
 	friend Number pow(int x, int exp) { return Number{ x } ^= exp; }
-	friend Number abs(const Number& no0) { return no0 >= 0 ? no0 : no0.operator-(); }
+	friend Number sqr(const Number& no0) { return Number{ no0 }.sqr_equ(); }
+	friend Number sqr(Number&& no0) { return std::move(no0.sqr_equ()); }
+	friend Number abs(const Number& no0) { Number no{ no0 }; no._neg = false; return no; }
+	friend Number abs(Number&& no0) { no0._neg = false; return std::move(no0); }
+
+	/*
+	Binary operators
+		The result takes the base and precision of the left operand. A
+		temporary operand is reused for the result instead of copied, the
+		right one only when it has the same base and precision (a + b == b + a,
+		a - b == -(b - a)), so a * b + c * d copies nothing but a and c.
+	*/
+	template <class T> friend Number operator ^ (const Number& no0, const T& exp) { return Number{ no0 } ^= exp; }
+	template <class T> friend Number operator + (const Number& no0, const T& value) { return Number(no0) += value; }
+	template <class T> friend Number operator - (const Number& no0, const T& value) { return Number(no0) -= value; }
+	template <class T> friend Number operator * (const Number& no0, const T& value) { return Number(no0) *= value; }
+	template <class T> friend Number operator / (const Number& no0, const T& value) { return Number(no0) /= value; }
+
+	template <class T> friend Number operator ^ (Number&& no0, const T& exp) { return std::move(no0 ^= exp); }
+	template <class T> friend Number operator + (Number&& no0, const T& value) { return std::move(no0 += value); }
+	template <class T> friend Number operator - (Number&& no0, const T& value) { return std::move(no0 -= value); }
+	template <class T> friend Number operator * (Number&& no0, const T& value) { return std::move(no0 *= value); }
+	template <class T> friend Number operator / (Number&& no0, const T& value) { return std::move(no0 /= value); }
+
+	friend Number operator + (Number&& no0, Number&& no1) { return std::move(no0 += no1); }
+	friend Number operator - (Number&& no0, Number&& no1) { return std::move(no0 -= no1); }
+	friend Number operator * (Number&& no0, Number&& no1) { return std::move(no0 *= no1); }
+	friend Number operator / (Number&& no0, Number&& no1) { return std::move(no0 /= no1); }
+
+	friend Number operator + (const Number& no0, Number&& no1)
+	{
+		if (!no1.same_base_precision(no0))
+			return Number(no0) += no1;
+		return std::move(no1 += no0);
+	}
+
+	friend Number operator - (const Number& no0, Number&& no1)
+	{
+		if (!no1.same_base_precision(no0))
+			return Number(no0) -= no1;
+		no1 -= no0;
+		no1.mul_minus_1();
+		return std::move(no1);
+	}
 
-	template <class T> friend Number operator ^ (const Number& no0, T exp) { return Number{ no0 } ^= exp; }
-	template <class T> friend Number operator + (const Number& no0, T value) { return Number(no0) += value; }
-	template <class T> friend Number operator - (const Number& no0, T value) { return Number(no0) -= value; }
-	template <class T> friend Number operator * (const Number& no0, T value) { return Number(no0) *= value; }
-	template <class T> friend Number operator / (const Number& no0, T value) { return Number(no0) /= value; }
+	friend Number operator * (const Number& no0, Number&& no1)
+	{
+		if (!no1.same_base_precision(no0))
+			return Number(no0) *= no1;
+		return std::move(no1 *= no0);
+	}
 
 	std::string to_bin_string() { return  to_string(2); }
 	std::string to_oct_string() { return  to_string(8); }
@@ -175,33 +2999,35 @@ public:
 
 protected:
 
-	const int& c_ms_digit() const { return _digits.front(); }
-	const int& c_ls_digit() const { return _digits.back(); }
+	const int& c_ms_digit() const { return _digits.back(); }
+	const int& c_ls_digit() const { return _digits.front(); }
 
 	bool is_self(const Number& other_no) const { return this == &other_no; }
 	bool same_base(const Number& no) const { return no.get_base() == get_base(); }
+	bool same_base_precision(const Number& no) const { return same_base(no) && no._precision == _precision; }
 
 	bool is_valid_exp(int exp) const { return exp <= (int)ms_exp() && exp >= (int)ls_exp(); }
 
 	bool reach_precision() const { return ls_exp() <= min_exp(); }
 	bool exceed_precision(int exp) const { return exp < min_exp(); }
 
+	static int cal_base_bits(int base)
+	{
+		int bits = 0;
+		while ((1 << bits) < base)
+			bits++;
+		return (1 << bits) == base ? bits : 0;
+	}
+
 	double cal_precision(int precision, int pre_base = 10) const { return precision * std::log(pre_base) / std::log(_base); }
 	int cal_safe_precision() const { return (int)std::ceil(std::ceil(_precision) * (1.0 + EXTRA_PRECISION)); }
 
-	int get_digit_index(int exp) const { return int(_ms_exp - exp); }
+	// _digits is stored least significant first.
+	int get_digit_index(int exp) const { return exp - ls_exp(); }
 
 	Number& add_equ(long long value)
 	{
-		int exp = 0;
-		while (value)
-		{
-			int i_value = value % _base;
-			value /= _base;
-			add_equ(i_value, exp++);
-		}
-
-		return *this;
+		return add_value(value, 0);
 	}
 
 	Number& power_equ(int exp)
@@ -222,7 +3048,7 @@ protected:
 		}
 
 		*this ^= (exp / 2);
-		*this *= *this;
+		sqr_equ();
 
 		if (exp & 1)
 		{
@@ -293,7 +3119,6 @@ protected:
 
 	std::string extract_string(int base, int digits_per_int, int precision_in_10)
 	{
-		static const char digit_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
 		assert(int(std::pow(base, digits_per_int)) == this->get_base());
 
 		const Number& out_no = (*this >= 0) ? *this : Number{ *this } *-1;
@@ -301,45 +3126,35 @@ protected:
 		int hi_exp = std::max(0, out_no.ms_exp());
 		int lo_exp = std::max(out_no.ls_exp(), out_no.min_comp_exp());
 		if (lo_exp > 0) lo_exp = 0;
-		int len = digits_per_int * (hi_exp - lo_exp + 2);
-
-		std::string str;
-		str.reserve((decltype(str.capacity()))len);
-		if (*this < 0) str += '-';
-
-		char buffer[0x100] = { 0 };
-		auto int_to_string = [base, digits_per_int, &buffer](int x, bool leading_zero)
-		{
-			buffer[1] = 0;
+		int count = hi_exp - lo_exp + 1;
 
-			int first = digits_per_int - 1;
-			for (int i = digits_per_int - 1; i >= 0; i--)
-			{
-				buffer[i] = digit_chars[x % base];
-				x /= base;
+		// digits [lo_exp, hi_exp] in one span, then all chars in one pass.
+		Kernel::ScratchFrame frame;
+		int* digits = frame.alloc_zero<int>(size_t(count));
+		int from = std::max(lo_exp, out_no.ls_exp()), to = std::min(hi_exp, out_no.ms_exp());
+		if (from <= to)
+			std::memcpy(digits + (from - lo_exp), out_no._digits.data() + out_no.get_digit_index(from), size_t(to - from + 1) * sizeof(int));
 
-				if (buffer[i] != '0')
-					first = i;
-			}
+		char* chars = frame.alloc<char>(size_t(count) * digits_per_int);
+		Kernel::to_chars(chars, digits, count, base, digits_per_int);
 
-			if (leading_zero)
-				return buffer;
+		// no leading zeros on the most significant digit.
+		int first = 0;
+		while (first < digits_per_int - 1 && chars[first] == '0')
+			first++;
 
-			return buffer + first;
-		};
+		std::string str;
+		str.reserve(size_t(count * digits_per_int + 2));
+		if (*this < 0) str += '-';
 
+		int int_chars = digits_per_int * (hi_exp + 1);
 		int dot_pos = -1;
-		for (int exp = hi_exp; exp >= lo_exp; exp--)
+		str.append(chars + first, chars + int_chars);
+		if (lo_exp <= -1)
 		{
-			int digit = out_no(exp);
-			if (exp == -1)
-			{
-				str += '.';
-				dot_pos = (int)str.size();
-			}
-
-			auto d_str = int_to_string(digit, exp == hi_exp ? false : true);
-			str += d_str;
+			str += '.';
+			dot_pos = (int)str.size();
+			str.append(chars + int_chars, chars + size_t(count) * digits_per_int);
 		}
 
 		// check precision in base 10.
@@ -363,11 +3178,7 @@ protected:
 		_precision = cal_precision(new_precision_10);
 		_safe_precision = cal_safe_precision();
 
-		int index = get_digit_index(min_exp());
-		if (index > _digits.size())
-			_digits.erase(_digits.begin() + index, _digits.end());
-
-		trim_low();
+		trim();
 		_digits.shrink_to_fit();
 	}
 
@@ -394,11 +3205,11 @@ protected:
 		if (lo_exp < min_comp_exp())
 			lo_exp = min_comp_exp();
 
-		int carry = 0;
+		long long carry = 0;
 		for (int exp = hi_exp; exp >= lo_exp; exp--)
 		{
-			auto xd = (*this)(exp);
-			auto yd = y(exp);
+			auto xd = signed_digit(exp);
+			auto yd = y.signed_digit(exp);
 			carry = carry * _base + xd - yd;
 
 			if (std::abs(carry) > 1)
@@ -409,8 +3220,8 @@ protected:
 			return 0;
 
 		// When carry != 0, need to check round result of remain digits.
-		int xd = (*this)(lo_exp - 1);
-		int yd = y(lo_exp - 1);
+		int xd = signed_digit(lo_exp - 1);
+		int yd = y.signed_digit(lo_exp - 1);
 		carry = carry * _base + xd - yd;
 
 		// Round carry
@@ -428,6 +3239,8 @@ protected:
 		return 0;
 	}
 
+	int signed_digit(int exp) const { return _neg ? -digit_value(exp) : digit_value(exp); }
+
 	const int& c_digit(int exp) const
 	{
 		assert(is_valid_exp(exp));
@@ -445,34 +3258,45 @@ protected:
 	Number& clear()
 	{
 		_ms_exp = 0;
-		_digits = { 0 };
+		_neg = false;
+		_digits.assign(1, 0);
 		return *this;
 	}
 
 	int& safe_get_digit(int exp)
 	{
-		int index = get_digit_index(exp);
-
-		if (index < 0)
+		if (exp > ms_exp())
 			return expand_hi_to(exp);
 
-		if (index >= _digits.size())
+		if (exp < ls_exp())
 			return expand_low_to(exp);
 
 		return (*this)[exp];
 	}
 
+	// Make sure digits of [lo_exp, hi_exp] are all present, return the span of lo_exp.
+	int* expand_to(int lo_exp, int hi_exp)
+	{
+		if (hi_exp > ms_exp())
+			expand_hi_to(hi_exp);
+
+		if (lo_exp < ls_exp())
+			expand_low_to(lo_exp);
+
+		return _digits.data() + get_digit_index(lo_exp);
+	}
+
 	void expand_hi_once()
 	{
 		_ms_exp++;
-		_digits.push_front(int(0));
+		_digits.push_back(int(0));
 	}
 
 	int& expand_hi_to(int to_exp)
 	{
 		int count = to_exp - _ms_exp;
-		while (count--)
-			expand_hi_once();
+		_digits.resize(_digits.size() + count, 0);
+		_ms_exp = to_exp;
 
 		return ms_digit();
 	}
@@ -482,7 +3306,7 @@ protected:
 		if (reach_precision())
 			throw std::length_error{ "exceed digits limit." };
 
-		_digits.push_back(int(0));
+		_digits.push_front(int(0));
 	}
 
 	int& expand_low_to(int to_exp)
@@ -491,24 +3315,28 @@ protected:
 			throw std::out_of_range{ "exceed lo precision" };
 
 		int count = ls_exp() - to_exp;
-		while (count--)
-			expand_lo_once();
+		_digits.extend_front(count, 0);
 
 		return ls_digit();
 	}
 
-	// ex: _base=10, -29 -> v:1 c:-2; -40 -> v:0, c:-4
+	// digit >= 0, ex: _base=10, 29 -> v:9 c:2
 	int gen_carry(int& digit)
 	{
-		int carry = digit / _base;
-		digit %= _base;
-
-		if (digit >= 0)
+		assert(digit >= 0);
+		if (_base_bits)
+		{
+			int carry = digit >> _base_bits;
+			digit &= _base - 1;
 			return carry;
+		}
+
+		if (digit < _base)
+			return 0;
 
-		// negative  => positive, carry--
-		digit += _base;
-		return --carry;
+		int carry = digit / _base;
+		digit -= carry * _base;
+		return carry;
 	}
 
 	int gen_carry(int& digit, int carry)
@@ -519,118 +3347,134 @@ protected:
 
 	bool need_trim() const
 	{
-		int msv = ms_value();
-
 		if (_digits.size() == 1)
-		{
-			if (msv == 0 && ms_exp() != 0)
-				return true;
-			return false;
-		}
-
-		int nd = msv * _base + digit_value(ms_exp() - 1);
-		if (std::abs(nd) < _base)
-			return false;
+			return ms_value() == 0 && (ms_exp() != 0 || _neg);
 
-		int lsv = ls_value();
-		return lsv == 0;
+		return ms_value() == 0 || ls_value() == 0;
 	}
 
 	void trim_high()
 	{
-		assert(get_digit_index(ms_exp()) >= 0);
+		assert(!_digits.empty());
 
 		// Keep last digit
-		while (_digits.size() > 1)
-		{
-			int msd = _digits[0];
-			if (msd > 0)
-				return;
-
-			if (msd == 0)
-			{
-				_ms_exp--;
-				_digits.pop_front();
-				continue;
-			}
-
-			// When msd < 0:
-			// -1, base-1, x, y, z, ...  ==> -1, x, y, z, ...
-			// -msd * base + next > -_base => reduce
-			if (msd == -1 && (*this)(ms_exp() - 1) == _base - 1)
-			{
-				_ms_exp--;
-				_digits.pop_front();
-				_digits[0] = -1;
-				continue;
-			}
+		size_t zeros = 0;
+		const int* top = _digits.end();
+		while (zeros + 1 < _digits.size() && !*--top)
+			zeros++;
 
-			return;
-		}
+		_ms_exp -= int(zeros);
+		_digits.pop_back(zeros);
 	}
 
 	void trim_low()
 	{
 		int exp = std::max(ls_exp(), min_exp());
 		int index = get_digit_index(exp);
-		assert(index >= 0);
+		int top = (int)_digits.size() - 1;
+		assert(index >= 0 && index <= top);
 
-		while (index && !_digits[index])
-			index--;
+		const int* digits = _digits.data();
+		while (index < top && !digits[index])
+			index++;
 
-		if (index + 1 < _digits.size())
-			_digits.erase(_digits.begin() + index + 1, _digits.end());
+		_digits.pop_front(index);
 	}
 
 	void check_zero()
 	{
-		if (_digits.size() == 1 && !_digits[0])
+		if (_digits.size() == 1 && !_digits.front())
+		{
 			_ms_exp = 0;
+			_neg = false;
+		}
 	}
 
 	void trim()
 	{
+		trim_high();
+
 		if (exceed_precision(ms_exp()))
 		{
 			clear();
 			return;
 		}
 
-		trim_high();
 		trim_low();
 		check_zero();
 	}
 
 	Number& add_equ(int value)
 	{
-		if (value == 0)
-			return *this;
-
-		int& digit = safe_get_digit(0);
-		digit += value;
-
-		int carry = gen_carry(digit);
-		add_carry(carry, 1);
-		return *this;
+		return add_equ(value, 0);
 	}
 
 	Number& add_equ(int value, int exp)
+	{
+		return add_value(value, exp);
+	}
+
+	// this += value * B^exp
+	Number& add_value(long long value, int exp)
 	{
 		if (value == 0 || exceed_precision(exp))
 			return *this;
 
-		int& digit = safe_get_digit(exp++);
-		digit += value;
+		int digits[64];
+		int n = 0;
+		for (Kernel::u64 rest = magnitude(value); rest; rest /= Kernel::u64(_base))
+			digits[n++] = int(rest % Kernel::u64(_base));
 
-		int carry = gen_carry(digit);
-		add_carry(carry, exp);
+		add_digits(digits, n, exp, value < 0);
 		return *this;
 	}
 
+	/*
+	Signed Add
+		this += (-1)^neg * value[0, n) * B^lo_exp, value in [0, base).
+
+		Same signs add the magnitudes. Otherwise value is subtracted from
+		the magnitude, and a borrow out of the top means |value| > |this|:
+		the digits then hold B^size - (|value| - |this|), one complement
+		pass gives the magnitude and the sign flips.
+	*/
+	void add_digits(const int* value, int n, int lo_exp, bool neg)
+	{
+		assert(n > 0 && !exceed_precision(lo_exp));
+
+		if (is_zero_strict())
+			_neg = neg;
+
+		int* digit = expand_to(lo_exp, std::max(ms_exp(), lo_exp + n - 1));
+		int count = ms_exp() - lo_exp + 1;
+
+		if (neg == _neg)
+		{
+			if (Kernel::add(digit, digit, count, value, n, _base))
+			{
+				expand_hi_once();
+				ms_digit() = 1;
+			}
+		}
+		else if (Kernel::sub(digit, digit, count, value, n, _base))
+		{
+			Kernel::negate(_digits.data(), int(_digits.size()), _base);
+			_neg = !_neg;
+		}
+
+		trim();
+	}
+
+	// digits [exp, ms_exp] += carry, carry >= 0.
 	void add_carry(int carry, int exp = 0)
 	{
-		while (carry != 0 && exp <= ms_exp())
-			carry = gen_carry(get_digit(exp++), carry);
+		if (carry != 0 && exp <= ms_exp())
+		{
+			int* digit = &get_digit(exp);
+			int* end = _digits.end();
+			while (carry != 0 && digit != end)
+				carry = gen_carry(*digit++, carry);
+		}
 
 		while (carry)
 		{
@@ -638,11 +3482,6 @@ protected:
 
 			int& digit = ms_digit();
 			digit = carry;
-
-			// ms_digit < 0 -> neg number, it's ok, done.
-			if (carry <= 0 && carry > -_base)
-				break;
-
 			carry = gen_carry(digit);
 		}
 
@@ -687,16 +3526,9 @@ protected:
 
 		int ms_exp = no.ms_exp();
 		int ls_exp = std::max(no.ls_exp(), min_exp());
+		if (ls_exp <= ms_exp)
+			add_digits(&no.c_digit(ls_exp), ms_exp - ls_exp + 1, ls_exp, no._neg != (SIGN < 0));
 
-		int carry = 0;
-		for (int exp = ls_exp; exp <= ms_exp; exp++)
-		{
-			int& digit = safe_get_digit(exp);
-			digit = digit + SIGN * no(exp) + carry;
-			carry = gen_carry(digit);
-		}
-
-		add_carry(carry, ms_exp + 1);
 		return *this;
 	}
 
@@ -704,30 +3536,25 @@ protected:
 	{
 		long long r = (long long)digit * multiplier + carry;
 
-		carry = (int)(r / _base);
-		digit = (int)(r % _base);
+		if (_base_bits)
+		{
+			digit = (int)(r & (_base - 1));
+			return (int)(r >> _base_bits);
+		}
 
-		carry += gen_carry(digit);
+		carry = (int)(r / _base);
+		digit = (int)(r - (long long)carry * _base);
 		return carry;
 	}
 
 	Number& mul_minus_1()
 	{
-		int carry = 0;
-		int exp = ls_exp();
-		for (; exp <= ms_exp(); exp++)
-		{
-			int& digit = (*this)[exp];
-			digit = -digit + carry;
-			carry = gen_carry(digit);
-		}
+		if (!is_zero_strict())
+			_neg = !_neg;
 
-		add_carry(carry, exp);
 		return *this;
 	}
 
-	Number mul(int multiplier, int value_exp) { return Number{ *this }.mul_equ(multiplier, value_exp); }
-
 	Number& mul_equ(int multiplier, int value_exp)
 	{
 		*this <<= value_exp;
@@ -747,84 +3574,275 @@ protected:
 		if (multiplier == 0)
 			return clear();
 
+		if (multiplier == std::numeric_limits<int>::min())
+			return mul_equ(pattern_new(multiplier));
+
 		int carry = 0;
-		int exp = ls_exp();
-		for (; exp <= ms_exp(); exp++)
+		int abs_multiplier = std::abs(multiplier);
+		if (_base_bits)
+		{
+			for (int& digit : _digits)
+				carry = mul_single_digit(digit, abs_multiplier, carry);
+		}
+		else
 		{
-			int& digit = (*this)[exp];
-			carry = mul_single_digit(digit, multiplier, carry);
+			// 64-bit carries, the int ones of mul_single_digit overflow for multipliers above base.
+			carry = Kernel::mul_1(_digits.data(), _digits.data(), int(_digits.size()), abs_multiplier, _base);
 		}
 
-		add_carry(carry, exp);
-		return *this;
+		add_carry(carry, ms_exp() + 1);
+		return multiplier < 0 ? mul_minus_1() : *this;
 	}
 
 	Number& mul_equ(const Number& no)
 	{
 		if (is_self(no))
-			return *this *= Number{ no };
+			return sqr_equ();
+
+		bool neg = _neg != no._neg;
+		mul_magnitude(no);
+
+		_neg = neg;
+		check_zero();
+		return *this;
+	}
+
+	// Columns kept below min_exp(), so that the carries from the skipped
+	// columns can not reach min_exp().
+	int mul_guard_digits(int count) const
+	{
+		int guard = 2;
+		for (long long reach = _base; reach <= count; reach *= _base)
+			guard++;
+		return guard;
+	}
+
+	// |this| = |this| * |no|, truncated to min_exp(), the sign is left to the caller.
+	// no may be this, the digits spans are then the same and sqr() is used.
+	void mul_magnitude(const Number& no)
+	{
+		assert(same_base(no));
+
+		if (is_zero_strict() || no.is_zero_strict())
+		{
+			clear();
+			return;
+		}
+
+		int cut_exp = min_exp() - mul_guard_digits(int(_digits.size() + no._digits.size()));
+
+		// digits which can only reach columns below cut_exp are dropped.
+		int a_ls = std::max(ls_exp(), std::min(ms_exp(), cut_exp - no.ms_exp() - 1));
+		int b_ls = std::max(no.ls_exp(), std::min(no.ms_exp(), cut_exp - ms_exp() - 1));
+
+		DigitBuffer result;
+		for (;;)
+		{
+			const int* a = &c_digit(a_ls);
+			const int* b = &no.c_digit(b_ls);
+			int na = ms_exp() - a_ls + 1;
+			int nb = no.ms_exp() - b_ls + 1;
+
+			result.resize(size_t(na + nb));
+			Kernel::mul(result.data(), a, na, b, nb, _base, cut_exp - (a_ls + b_ls));
+
+			if (a_ls == ls_exp() && b_ls == no.ls_exp() && cut_exp <= a_ls + b_ls)
+				break;
+
+			// The dropped products (below cut_exp) add up to less than m * B^(cut_exp + 1), m: digits
+			// of the shorter operand, the kept digits from cut_exp down to less than B^(cut_exp + 1).
+			// Unless m + 1 at cut_exp + 1 carries into min_exp(), the truncated product is the full
+			// one's; else (less than 1 in B) it is redone in full.
+			Kernel::u64 carry = std::min(_digits.size(), no._digits.size()) + 1;
+			for (int exp = cut_exp + 1; exp < min_exp() && carry; exp++)
+			{
+				int index = exp - (a_ls + b_ls);
+				carry = (Kernel::u64(index >= 0 ? result[size_t(index)] : 0) + carry) / Kernel::u64(_base);
+			}
+
+			if (!carry)
+				break;
+
+			a_ls = ls_exp();
+			b_ls = no.ls_exp();
+			cut_exp = a_ls + b_ls;
+		}
+
+		_ms_exp = ms_exp() + no.ms_exp() + 1;
+		_digits = std::move(result);
+		trim();
+	}
+
+	/*
+	Base Conversion
+		The digits [ls_exp, ms_exp] of a positive number are one integer
+		A, so that the number is A * B^ls_exp. A is converted by divide and
+		conquer, split at h = 2^k digits:
+			A = A_hi * B^h + A_lo  =>  conv(A) = conv(A_hi) * conv(B^h) + conv(A_lo)
+
+		conv(B^(2^k)) comes from the cached power tree (radix_powers), and
+		B^ls_exp is a product of its levels. With the fast multiplication
+		and division, the cost is O(M(n) log n) instead of O(n^2).
+	*/
+	Number convert_positive(int new_base, double precision_in_base) const
+	{
+		assert(is_positive());
+
+		int a, b;
+		int root = perfect_power(_base, a);
+		if (perfect_power(new_base, b) == root)
+			return repack_positive(new_base, precision_in_base, root, a, b);
+
+		int n = int(_digits.size());
+		int shift = ls_exp();
+
+		// all the powers used below, the tree only grows, so pointers to its levels stay put.
+		int levels = 0;
+		while ((1 << levels) < std::max(n, std::abs(shift)))
+			levels++;
+
+		std::vector<const Number*> powers;
+		for (auto& power : radix_powers(_base, new_base, levels))
+			powers.push_back(&power);
+
+		Number result(BasePrecision::V, 0, precision_in_base, new_base);
+		result += convert_digits(_digits.data(), n, _base, new_base, powers);
+
+		if (shift)
+		{
+			Number scale(BasePrecision::V, 1, 0, new_base);
+			for (int level = 0; (1 << level) <= std::abs(shift); level++)
+			{
+				if (std::abs(shift) & (1 << level))
+					scale *= *powers[size_t(level)];
+			}
+
+			if (shift > 0)
+				result *= scale;
+			else
+				result /= scale;
+		}
+
+		return result;
+	}
+
+	/*
+	Digit Repacking
+		When the old base is R^a and the new base is R^b, the old digit at
+		exp k is the R-digits [a*k, a*k + a), they are only regrouped by b
+		into the new digits: linear time, and exact down to the precision.
+		ex: 10 <=> 10^9, 2 <=> 2^30, 10^4 <=> 10^9.
+	*/
+	Number repack_positive(int new_base, double precision_in_base, int root, int a, int b) const
+	{
+		auto floor_div = [](long long x, int y) { return int(x >= 0 ? x / y : -((-x + y - 1) / y)); };
+
+		int lo = floor_div((long long)a * ls_exp(), b);
+		int hi = floor_div((long long)a * (ms_exp() + 1) - 1, b);
+
+		std::vector<int> weights(size_t(b), 1);
+		for (int i = 1; i < b; i++)
+			weights[size_t(i)] = weights[size_t(i - 1)] * root;
+
+		Number result(BasePrecision::V, 0, precision_in_base, new_base);
+		result._digits.assign(size_t(hi - lo + 1), 0);
+		result._ms_exp = hi;
 
-		Number clone_of_this(std::move(*this));
-		this->clear();
+		long long exp = (long long)a * ls_exp();
+		for (int digit : _digits)
+		{
+			for (int i = 0; i < a; i++, exp++)
+			{
+				int r_digit = digit % root;
+				digit /= root;
+				if (!r_digit)
+					continue;
+
+				int k = floor_div(exp, b);
+				result._digits[size_t(k - lo)] += r_digit * weights[size_t(exp - (long long)k * b)];
+			}
+		}
+
+		result.trim();
+		return result;
+	}
 
-		for (int exp = no.ms_exp(); exp >= no.ls_exp(); exp--)
+	// base = root^exp with the smallest root.
+	static int perfect_power(int base, int& exp)
+	{
+		for (exp = 30; exp > 1; exp--)
 		{
-			Number tmp = clone_of_this.mul(no(exp), exp);
-			*this += tmp;
+			int root = int(std::round(std::pow(base, 1.0 / exp)));
+			long long power = 1;
+			for (int i = 0; i < exp && power <= base; i++)
+				power *= root;
+
+			if (root > 1 && power == base)
+				return root;
 		}
 
-		return *this;
+		exp = 1;
+		return base;
 	}
 
-	Number convert_frac_result(int new_base, double precision_in_base) const
+	// digits[0, n) of old_base as an integer of new_base, powers: levels of the radix_powers tree.
+	// The halves are forked from Kernel::PARALLEL_GRAIN digits on (outside of a MemoryScope), tasks read powers only.
+	static Number convert_digits(const int* digits, int n, int old_base, int new_base, const std::vector<const Number*>& powers)
 	{
-		Number frac_result(BasePrecision::V, 0, precision_in_base, new_base);
-		Number pow_base = frac_result.pattern_new(1);
-
-		int old_base = get_base();
-		if (ms_exp() < -1)
+		if (n <= Kernel::CONVERT_DC_THRESHOLD)
 		{
-			pow_base = old_base;
-			pow_base ^= (ms_exp() + 1);
+			Number result(BasePrecision::V, 0, 0, new_base);
+			for (int k = n - 1; k >= 0; k--)
+			{
+				result.mul_equ(old_base);
+				result.add_equ(digits[k]);
+			}
+
+			return result;
 		}
 
-		for (int exp = std::min(-1, ms_exp());
-			exp >= ls_exp() && !pow_base.is_zero_strict();
-			exp--)
-		{
-			int value = (*this)(exp);
-			pow_base /= old_base;
-			Number pv = pow_base * value;
+		int level = 0;
+		while ((2 << level) < n)
+			level++;
 
-			frac_result += pv;
-		}
+		int h = 1 << level;
+		Number high, low;
+		Kernel::fork_tasks(2, Kernel::may_fork_numbers(n), [&](int i)
+		{
+			if (i == 0)
+			{
+				high = convert_digits(digits + h, n - h, old_base, new_base, powers);
+				high *= *powers[size_t(level)];
+			}
+			else
+			{
+				low = convert_digits(digits, h, old_base, new_base, powers);
+			}
+		});
 
-		return frac_result;
+		high += low;
+		return high;
 	}
 
-	Number convert_int_base(int new_base, double precision_in_base) const
+	// old_base^(2^k) in new_base for k in [0, level], the levels are kept per thread and base pair.
+	// They outlive any MemoryScope of the caller, so they are built on the default heap.
+	static const std::deque<Number>& radix_powers(int old_base, int new_base, int level)
 	{
-		Number int_result(BasePrecision::V, 0, precision_in_base, new_base);
-		Number pow_base = int_result.pattern_new(1);
+		thread_local std::map<std::pair<int, int>, std::deque<Number>> trees;
+		auto& powers = trees[{ old_base, new_base }];
+		MemoryScope scope{ std::pmr::new_delete_resource() };
 
-		int old_base = get_base();
+		if (powers.empty())
+			powers.push_back(Number(BasePrecision::V, old_base, 0, new_base));
 
-		if (ls_exp() > 0)
+		while (int(powers.size()) <= level)
 		{
-			pow_base = old_base;
-			pow_base ^= (ls_exp() - 1);
+			Number next{ powers.back() };
+			next.sqr_equ();
+			powers.push_back(std::move(next));
 		}
 
-		int_result = (*this)(0);
-		for (int exp = std::max(1, ls_exp()); exp <= ms_exp(); exp++)
-		{
-			pow_base *= old_base;
-			int value = (*this)(exp);
-			Number pv = pow_base * value;
-			int_result += pv;
-		}
-
-		return int_result;
+		return powers;
 	}
 
 	Number get_frac_part()
@@ -836,8 +3854,7 @@ protected:
 		if (ms_exp() >= 0)
 		{
 			result._ms_exp = -1;
-			result._digits.clear();
-			result._digits.insert(result._digits.begin(), this->_digits.begin() + ms_exp() + 1, this->_digits.end());
+			result._digits.assign(this->_digits.begin(), this->_digits.begin() + get_digit_index(0));
 		}
 		else
 		{
@@ -845,6 +3862,8 @@ protected:
 			result._digits = this->_digits;
 		}
 
+		result._neg = _neg;
+		result.trim();
 		return result;
 	}
 
@@ -858,11 +3877,10 @@ protected:
 		if (ls_exp() >= 0)
 			result._digits = this->_digits;
 		else
-		{
-			result._digits.clear();
-			result._digits.insert(result._digits.begin(), this->_digits.begin(), this->_digits.begin() + ms_exp() + 1);
-		}
+			result._digits.assign(this->_digits.begin() + get_digit_index(0), this->_digits.end());
 
+		result._neg = _neg;
+		result.trim();
 		return result;
 	}
 
@@ -901,7 +3919,7 @@ protected:
 				throw std::invalid_argument{ "number string format error." };
 
 			p++;
-			no._digits.push_back(x);
+			no._digits.push_front(x);
 		}
 
 		if (!has_dot)
@@ -947,344 +3965,526 @@ protected:
 		return exp;
 	}
 
-	/*
-	Division Method
-	* The effecient method is complicated.
+	void div_positive(Number& M, const Number& N, Number& Q)
+	{
+		assert(!M.need_trim() && !N.need_trim() && !Q.need_trim());
+		assert(Q.same_base(M) && Q.same_base(N));
 
-	Define:
-		[x0,x1,...]<exp,B> = x0*B^exp + x1*B^(exp-1) + ...
+		if (N.is_zero_strict())
+			throw std::overflow_error{ "divided by 0!" };
 
-	* Note x0 will be 0 only when the whole number is zero.
-	* We can omit B/[] when not cofused.
+		Q.clear();
+		if (N.is_one())
+		{
+			M >>= N.ms_exp();
+			Q = M;
+			return;
+		}
 
-	For:
-		M => [m0,m1,m2,...]<eM,B>
-		N => [n0,n1,n2,...]<eN,B>
+		// Newton pays off only when both the divisor and the quotient are long.
+		int q_digits = M.ms_exp() - N.ms_exp() - Q.min_exp() + 1;
+		if (std::min(q_digits, (int)N._digits.size()) >= Kernel::DIV_NEWTON_THRESHOLD)
+			return div_newton(M, N, Q);
 
-		N != 0
+		div_basecase(M, N, Q);
+	}
 
-	I. Method Explianation:
-		Set: Q = 0			==> for M/N
+	/*
+	Long Division
+		Q = floor(M / (N * B^q)) * B^q, q = Q.min_exp(), M is left with the
+		exact remainder M - Q * N.
+
+		With M = A * B^eA and N = D * B^eD (A, D integers), that is the
+		integer division of A * B^s by D, s = eA - eD - q, done in one go by
+		Kernel::divrem. When s < 0 the low -s digits of A are below the
+		quotient, they only come back in the remainder.
+	*/
+	void div_basecase(Number& M, const Number& N, Number& Q)
+	{
+		int q_exp = Q.min_exp();
+		int shift = M.ls_exp() - N.ls_exp() - q_exp;
+		int low = std::max(0, -shift);
+		int high = std::max(0, shift);
+
+		int nu = int(M._digits.size()) + shift;
+		int nv = int(N._digits.size());
+		if (nu < nv)
+			return;
 
-	1) Get q* (try-out digit of Q)
+		// u: A * B^high, with room for the scaling digit
+		DigitBuffer u;
+		u.resize(size_t(high + M._digits.size() + 1));
+		std::copy(M._digits.begin(), M._digits.end(), u.begin() + high);
+
+		Kernel::ScratchFrame frame;
+		int* v = frame.alloc<int>(size_t(nv));
+		std::copy(N._digits.begin(), N._digits.end(), v);
+
+		DigitBuffer q;
+		q.resize(size_t(nu - nv + 1));
+		Kernel::divrem(q.data(), u.data() + low, nu, v, nv, _base);
+
+		Q._digits = std::move(q);
+		Q._ms_exp = q_exp + nu - nv;
+		Q.trim();
+
+		// remainder: u[0, low + nv), u[0] at M.ls_exp() - high
+		int r_ls = M.ls_exp() - high;
+		Number R = new_with_min_exp(r_ls);
+		u.resize(size_t(low + nv));
+		R._digits = std::move(u);
+		R._ms_exp = r_ls + low + nv - 1;
+		R.trim();
+		M = std::move(R);
+	}
 
-		To calculate Q's first non-zeor digit, we can just take
-		look on the first two digits.
-			e* = eM - eN
-			q# = [m0,m1] / [n0,n1]
-			q* = floor(q#)
-			q- = q-min = floor([m0,m1] / [n0,(n1+1)])
-			q+ = q-max = floor([m0,(m1+1)] / [n0,n1])
+	/*
+	Newton Division
+		x = 1/N by Newton iteration, the precision doubles every step:
+			x' = x + x * (1 - N * x)
 
-		There will be:
-			q- <= q <= q+
-			q- <= q* <= q+
+		Then Q = M * x, and Q is corrected by the exact remainder M - Q * N,
+		so Q is the same truncated quotient as div_basecase gives.
+		The cost is a few multiplications of the quotient size.
+	*/
+	void div_newton(Number& M, const Number& N, Number& Q)
+	{
+		int q_exp = Q.min_exp();
+		int q_digits = M.ms_exp() - N.ms_exp() - q_exp + 1;
+		if (q_digits <= 0)
+			return;
 
-		And we can be prove easily, that:
-			<1>	q* = q+ (When B >= 2)
-			<2>	q - q- = 0/1
-			<3>	q = q* - 0/1
+		int guard = mul_guard_digits(64);
+
+		Number n{ N };
+		n >>= N.ms_exp();
+		Number x = reciprocal(n, q_digits + guard);
+
+		// Q = M * x / B^N.ms_exp, truncated
+		Number P = new_with_min_exp(q_exp + N.ms_exp() - guard);
+		P += M;
+		P *= x;
+		P >>= N.ms_exp();
+		Q += P;
+
+		// R = M - Q * N, exact
+		Number R = new_with_min_exp(std::min({ M.ls_exp(), q_exp, q_exp + N.ls_exp() }));
+		Number QN{ R };
+		QN += Q;
+		QN *= N;
+		R += M;
+		R -= QN;
+
+		// 0 <= R < N * B^q_exp
+		Number N_ulp{ N };
+		N_ulp <<= q_exp;
+		while (R.is_negative())
+		{
+			Q.add_equ(-1, q_exp);
+			R += N_ulp;
+		}
 
-		When q* < 1:
-			q* = [q# * B]
-			e*--
-		After multiplecation q* will be great/equal than 1 for sure.
+		for (Number D = R - N_ulp; D.is_non_neg(); D -= N_ulp)
+		{
+			Q.add_equ(1, q_exp);
+			R = D;
+		}
 
-	2) Try q*
+		M = std::move(R);
+	}
 
-		NQ = N * q*<e*>
-		new_M = M - NQ
+	// x ~ 1/n, n in [1, base), to digits fraction digits.
+	Number reciprocal(const Number& n, int digits) const
+	{
+		assert(n.ms_exp() == 0 && n.is_positive());
 
-		Check new_M:
-			1. new_M < 0:
-				a> q* > 1:
-					q = q* - 1
-					new_M += N * 1<e*>
+		// start from a double, good for about 48 bits
+		int guard = mul_guard_digits(64);
+		int cur = std::max(1, int(48 / std::log2(_base)));
 
-				b> q* == 1:
-					q = B - 1
-					e*--
-					new_M += N * 1<e*>
+		double nv = 0, weight = 1;
+		for (int exp = 0; exp >= -(cur + 2); exp--, weight /= _base)
+			nv += n(exp) * weight;
 
-			2. new_M >= 0
-				q = q*
+		Number x(BasePrecision::V, 1.0 / nv, cur + guard, _base);
 
-	3) Update
-		Q += q<e*>
-		M = new_m;
-		Repeat to 1)
+		while (cur < digits)
+		{
+			cur = std::min(2 * cur, digits);
+			double precision = cur + guard;
+
+			// e = 1 - n * x
+			Number e(BasePrecision::V, 0, precision, _base);
+			e += n;
+			e *= x;
+			e.mul_minus_1();
+			e += 1;
+
+			// x = x + x * e
+			e *= x;
+			Number next(BasePrecision::V, 0, precision, _base);
+			next += x;
+			next += e;
+			x = std::move(next);
+		}
 
-	II. Two-Digits Division
+		return x;
+	}
 
-	Use float/double div operation.
-		x = m0 + m1 / B
-		y = n0 + n1 / B
-		q# = x / y
-	* This method only correct when B <= 2^32.
-	*/
+	// A zero whose digits reach down to exp (at least).
+	Number new_with_min_exp(int exp) const
+	{
+		return Number(BasePrecision::V, 0, std::max(0, -exp), _base);
+	}
 
 	/*
-	III. Example: 1800/25800
-
-	1) Get q*
+	Short Division
+		One pass from the most significant digit down to min_exp(): the
+		remainder r < N carries into the next digit as r * B + digit, and
+		the quotient digits overwrite the digits in place.
 
-		Q: [0]<0, 10>
-		M: [1,8]<3, 10>
-		N: [2,5,8]<4, 10>
+		N * B must fit in 64 bits, larger divisors go through long division.
+	*/
+	Number& div_equ(long long N)
+	{
+		if (N == 1) return *this;
+		if (N == -1) return mul_minus_1();
 
-		e* = 3 - 4 = -1
-		q# = [1,8]/[2,5] = 0.72
-		q* = [q#] = 0
+		if (!N) throw std::overflow_error{ "divided by 0!" };
 
-		q* = [q# * B] = 7
-		e* = e* - 1 = -2
+		Kernel::u64 divisor = magnitude(N);
+		if (divisor > ~Kernel::u64(0) / Kernel::u64(_base))
+			return div_equ(pattern_new(N));
 
-	2) Try q*
+		if (is_zero_strict())
+			return *this;
 
-		q* = 7, e* = -2
-		nq = N * q*<e*> = [2,5,8]<4> * 7<-2> = 1806 = [1,8,0,6]<3>
-		new_m = M - tmp_nq = [1,8]<3> - [1,8,0,6]<3> = -6<0>
+		bool neg_M = is_negative();
+		if (neg_M) mul_minus_1();
 
-		Note that new_m < 0, so:
-			q = q* - 1
-			new_m += N * 1<e*> = -6<0> + [2,5,8]<4> * 1<-2> = 258<2> -6<0> = 252<2>
+		int hi = ms_exp();
+		int* digits = expand_to(min_exp(), hi);
+		int n = hi - min_exp() + 1;
+		Kernel::divrem_1(digits, digits, n, divisor, _base);
+		trim();
 
-	3) Update Q
+		if (neg_M != (N < 0)) mul_minus_1();
+		return *this;
+	}
 
-		Q = Q + q<e*> = 0 + 6<-2> = 6<-2>
-		M = new_m = [2,5,2]<2>
+	static Kernel::u64 magnitude(long long value)
+	{
+		return value < 0 ? 0 - Kernel::u64(value) : Kernel::u64(value);
+	}
 
-	4) Get q*
+	Number& div_equ(const Number& N)
+	{
+		if (N == 0)
+			throw std::overflow_error{ "divided by 0!" };
 
-		Q: [6]<-2>
-		M: [2,5,2]<2>
-		N: [2,5,8]<4>
+		if (is_self(N))
+			return *this = 1;
 
-		e* = -2
-		q# = [2,5] / [2,5] = 1
-		q* = 1
+		Number M{ std::move(*this) };
+		Number& Q{ this->clear() };
 
-	5) Try q*
+		bool neg_M = M.is_negative();
+		bool neg_N = N.is_negative();
+		bool neg_Q = neg_M != neg_N;
 
-		q* = 1, e* = -2
-		tmp_nq = N * q*<e*> = 258
-		new_m = M - tmp_nq = 252 - 258 = -6
+		M._neg = false;
+		div_positive(M, neg_N ? abs(N) : N, Q);
+		if (neg_Q) Q.mul_minus_1();
 
-		new_m < 0:
-			q* == 1:
-				q = B - 1 = 9
-				e* = e* - 1 = -3
-				new_m = new_m + N * 1<e*> = -6<0> + [2,5,8]<4> * 1<-3> = -6<0> + [2,5,8]<1> = [1,9,8]<1>
+		return *this;
+	}
 
-		Q = Q + q*<e*> = 6<-2> + 9<-3> = 69<-2>
-		M = new_m = 198<1>
+	void compile_test()
+	{
+		Number no0(1.0);
+		Number no1(1, 10);
+		Number no2((long long)1e15);
 
-	6) Get q*
+		no2 += no1;
+		no2 -= no1;
+		no2 *= no1;
+		no2 /= no1;
 
-		Q = 69<-2>
-		M = 192<1>
-		N = 258<4>
+		no1 += 0.5;
+		no1 -= 0.5;
 
-		e* = 1 - 4 = -3
-		q# = 19/25 = 0.76
-		q_exp* = -3
-		q# = 1,9/2,5 = 0.76
+		no1 *= 0.7;
+		no1 *= no2;
 
-		q* = [q# * 10] = 7
-		e* = e* - 1 = -4
+		no2 ^= 4;
+		no1 = no2 ^ 0;
 
-	7) Try q*
-		q* = 7
-		e* = -4
+		no0 = no2 / 4.5;
+		no1 = no1 * 48.78;
+	}
 
-		tmp_nq = N * q*<-4> = 258<4> * 7<-4> = 1806<1>
-		new_m = M - tmp_nq = 198<1> - 1806<1> = 174<0>
+public:
 
-		q = q*
-		Q = Q + q<e*> = 69<-2> + 7<-4> = 697<-2>
-	...
+	// this = this * this in place, no copy of this.
+	Number& sqr_equ()
+	{
+		_neg = false;
+		mul_magnitude(*this);
+		return *this;
+	}
 
+	/*
+	Multiply-Divide
+		*this * num / den in one pass (Kernel::mul_divrem_1), truncated at
+		min_exp() as div_equ(long long) does. (num + den) * B must fit in
+		64 bits, otherwise it is a multiplication and a division.
 	*/
-
-	std::pair<int, int> get_q_star(const Number& m, const Number& n)
+	Number& mul_div_equ(long long num, long long den)
 	{
-		int exp_m = m.ms_exp(), m0 = m(exp_m), m1 = m(exp_m - 1);
-		int exp_n = n.ms_exp(), n0 = n(exp_n), n1 = n(exp_n - 1);
+		if (!den) throw std::overflow_error{ "divided by 0!" };
 
-		double mv = m0 + m1 * 1.0 / _base;
-		double nv = n0 + n1 * 1.0 / _base;
+		Kernel::u64 n = magnitude(num), d = magnitude(den);
+		Kernel::u64 limit = ~Kernel::u64(0) / Kernel::u64(_base);
+		if (n >= limit || d >= limit - n)
+			return mul_equ(pattern_new(num)).div_equ(den);
 
-		int e = exp_m - exp_n;
-		double q_p = mv / nv;
+		if (!num || is_zero_strict())
+			return clear();
 
-		if (q_p >= 1)
-			return std::make_pair((int)std::floor(q_p), e);
+		bool neg = is_negative();
+		if (neg) mul_minus_1();
 
-		return std::make_pair((int)std::floor(q_p * _base), e - 1);
-	}
+		// room for the digits of num
+		int hi = ms_exp() + 1;
+		for (Kernel::u64 rest = n / Kernel::u64(_base); rest; rest /= Kernel::u64(_base))
+			hi++;
 
-	void div_positive(Number& M, const Number& N, Number& Q)
-	{
-		assert(!M.need_trim() && !N.need_trim() && !Q.need_trim());
-		assert(Q.same_base(M) && Q.same_base(N));
+		int* digits = expand_to(min_exp(), hi);
+		Kernel::mul_divrem_1(digits, hi - min_exp() + 1, n, d, _base);
+		trim();
 
-		if (N.is_zero_strict())
-			throw std::overflow_error{ "divided by 0!" };
+		if (neg != ((num < 0) != (den < 0))) mul_minus_1();
+		return *this;
+	}
 
-		Q.clear();
-		if (N.is_one())
+	// Apply num / den of each pair in turn, neighbours whose product still
+	// fits a single pass are folded together.
+	Number& mul_div_equ(std::initializer_list<std::pair<long long, long long>> ratios)
+	{
+		const Kernel::u64 limit = ~Kernel::u64(0) / Kernel::u64(_base);
+		auto fits = [limit](Kernel::u64 num, Kernel::u64 den)
 		{
-			M >>= N.ms_exp();
-			Q = M;
-			return;
-		}
+			return num < limit && den < limit - num;
+		};
 
-		Number dup_N{ N };
-		while (M.ms_value())
+		Kernel::u64 num = 1, den = 1;
+		bool neg = false, pending = false;
+		auto flush = [&]()
 		{
-			// get q* to try-out
-			auto [q_star, e_star] = get_q_star(M, N);
-			assert(q_star);
-			if (exceed_precision(e_star))
-				break;
+			if (pending)
+				mul_div_equ(neg ? -(long long)num : (long long)num, (long long)den);
 
-			Number NQ{ dup_N };
-			NQ.mul_equ(q_star, e_star);
-			if (NQ.is_zero_strict())
-				break;
+			num = den = 1;
+			neg = pending = false;
+		};
+
+		for (auto [n, d] : ratios)
+		{
+			Kernel::u64 abs_n = magnitude(n), abs_d = magnitude(d);
+			if (!abs_d)
+				throw std::overflow_error{ "divided by 0!" };
 
-			M -= NQ;
-			if (M.is_negative())
+			bool can_fold = (!abs_n || num <= limit / abs_n) && den <= limit / abs_d;
+			if (!can_fold || !fits(num * abs_n, den * abs_d))
 			{
-				if (q_star > 1)
-					q_star--;
-				else
+				flush();
+				if (!fits(abs_n, abs_d))
 				{
-					assert(q_star == 1);
-					q_star = _base - 1;
-					--e_star;
+					mul_div_equ(n, d);
+					continue;
 				}
-
-				dup_N <<= e_star;
-				M += dup_N;
-				dup_N >>= e_star;
 			}
 
-			Q.add_equ(q_star, e_star);
+			num *= abs_n;
+			den *= abs_d;
+			neg ^= (n < 0) != (d < 0);
+			pending = true;
 		}
-	}
-
-	std::pair<int, int> get_q_star(const Number& m, int n)
-	{
-		int e = m.ms_exp(), m0 = m(e), m1 = m(e - 1);
-		double mv = m0 + m1 * 1.0 / _base;
-		double q_p = mv / n;
 
-		while (q_p < 1)
-		{
-			q_p *= _base;
-			e--;
-		}
-		return std::make_pair((int)std::floor(q_p), e);
+		flush();
+		return *this;
 	}
 
-	Number& div_equ(int N)
+	/*
+	Fused Sum of Products
+		this = sum of (-1)^neg * x * y (x alone without y), in the base and
+		precision of this. Each product is one Kernel::mul into scratch
+		memory, less the digits which only reach columns below the guard
+		digits (as mul_magnitude), and is added to one of two accumulators,
+		positive or negative terms. Their difference is truncated once, no
+		full-size Number is built on the way. The terms may refer to this.
+	*/
+	Number& assign_products(const ProductTerm* terms, int count)
 	{
-		if (N == 1) return *this;
-		if (N == -1) return *this *= -1;
-
-		if (!N) throw std::overflow_error{ "divided by 0!" };
+		// terms in another base are worked out as the operators do, then converted.
+		// reserved so that pointers stay valid.
+		std::vector<Number> converted;
+		auto in_base = [&](const Number* x, const Number* y) -> const Number*
+		{
+			if (converted.empty())
+				converted.reserve(size_t(count));
+			converted.push_back((y ? *x * *y : *x).convert_base(_base));
+			return &converted.back();
+		};
 
-		auto M{ *this };
-		this->clear();
+		struct Term { const Number* x; const Number* y; bool neg; };
+		Kernel::ScratchFrame frame;
+		Term* list = frame.alloc<Term>(size_t(count));
 
-		auto& Q{ *this };
-		assert(!M.need_trim() && !Q.need_trim());
+		int n = 0, total_digits = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const Number* x = terms[i].x;
+			const Number* y = terms[i].y;
+			if (!same_base(*x) || (y && !same_base(*y)))
+			{
+				x = in_base(x, y);
+				y = nullptr;
+			}
 
-		bool neg_M = M < 0;
-		bool neg_N = N < 0;
-		bool neg_Q = neg_M != neg_N;
+			if (x->is_zero_strict() || (y && y->is_zero_strict()))
+				continue;
 
-		if (neg_N) N *= -1;
-		if (neg_M) M *= -1;
+			list[n++] = { x, y, terms[i].neg != (x->_neg != (y && y->_neg)) };
+			total_digits += int(x->_digits.size()) + (y ? int(y->_digits.size()) : 0);
+		}
 
-		while (M.ms_value())
+		int lo = std::numeric_limits<int>::max(), hi = std::numeric_limits<int>::min();
+		for (int i = 0; i < n; i++)
 		{
-			auto [q_star, e_star] = get_q_star(M, N);
-			assert(q_star);
-			if (exceed_precision(e_star))
-				break;
+			const Number& x = *list[i].x;
+			const Number* y = list[i].y;
+			lo = std::min(lo, y ? x.ls_exp() + y->ls_exp() : x.ls_exp());
+			hi = std::max(hi, y ? x.ms_exp() + y->ms_exp() + 1 : x.ms_exp());
+		}
 
-			Number NQ = pattern_new(N);
-			NQ.mul_equ(q_star, e_star);
+		if (!n)
+			return clear();
 
-			M -= NQ;
-			Q.add_equ(q_star, e_star);
-		}
+		// columns below cut_exp are dropped, unless their carries could reach min_exp() (see below).
+		const int exact_lo = lo;
+		int cut_exp = min_exp() - mul_guard_digits(total_digits);
+		int* sum[2];
+		int width;
+		bool neg;
+		for (;;)
+		{
+			lo = std::max(exact_lo, cut_exp);
+			if (lo > hi)
+				return clear();
+
+			// room for the carries of count terms
+			width = hi - lo + 2;
+			for (long long reach = _base; reach < n; reach *= _base)
+				width++;
+
+			sum[0] = frame.alloc_zero<int>(size_t(width));
+			sum[1] = frame.alloc_zero<int>(size_t(width));
+			auto accumulate = [&](bool neg, const int* digits, int count, int exp)
+			{
+				int skip = std::max(0, lo - exp);
+				if (skip >= count)
+					return;
+
+				int offset = exp + skip - lo;
+				int carry = Kernel::add(sum[neg] + offset, sum[neg] + offset, width - offset, digits + skip, count - skip, _base);
+				assert(!carry);
+				(void)carry;
+			};
+
+			// the dropped parts of the terms add up to less than dropped * B^(cut_exp + 1).
+			Kernel::u64 dropped = 0;
+			for (int i = 0; i < n; i++)
+			{
+				const Number& x = *list[i].x;
+				if (!list[i].y)
+				{
+					accumulate(list[i].neg, &x.c_digit(x.ls_exp()), int(x._digits.size()), x.ls_exp());
+					dropped++;
+					continue;
+				}
 
-		if (neg_Q) Q *= -1;
-		return *this;
-	}
+				const Number& y = *list[i].y;
+				int a_ls = std::max(x.ls_exp(), std::min(x.ms_exp(), cut_exp - y.ms_exp() - 1));
+				int b_ls = std::max(y.ls_exp(), std::min(y.ms_exp(), cut_exp - x.ms_exp() - 1));
+				int na = x.ms_exp() - a_ls + 1;
+				int nb = y.ms_exp() - b_ls + 1;
+
+				Kernel::ScratchFrame product_frame;
+				int* product = product_frame.alloc<int>(size_t(na + nb));
+				Kernel::mul(product, &x.c_digit(a_ls), na, &y.c_digit(b_ls), nb, _base, cut_exp - (a_ls + b_ls));
+				accumulate(list[i].neg, product, na + nb, a_ls + b_ls);
+				dropped += std::min(x._digits.size(), y._digits.size()) + 1;
+			}
 
-	Number& div_equ(const Number& N)
-	{
-		if (N == 0)
-			throw std::overflow_error{ "divided by 0!" };
+			neg = Kernel::compare(sum[1], sum[0], width) > 0;
+			Kernel::sub(sum[neg], sum[neg], width, sum[!neg], width, _base);
 
-		if (is_self(N))
-			return *this = 1;
+			if (exact_lo >= cut_exp)
+				break;
 
-		Number M{ std::move(*this) };
-		Number& Q{ this->clear() };
+			// As in mul_magnitude, per term: the exact sum differs from this one by less than
+			// dropped * B^(cut_exp + 1), either way (both sides drop). Unless adding or taking
+			// that from the digits [cut_exp, min_exp()) crosses min_exp(), the truncated digits
+			// are exact; else the sum is redone without dropping.
+			Kernel::u64 carry = dropped, borrow = dropped;
+			for (int exp = cut_exp + 1; exp < min_exp() && (carry || borrow); exp++)
+			{
+				Kernel::u64 digit = exp - lo < width ? Kernel::u64(sum[neg][exp - lo]) : 0;
+				carry = (digit + carry) / Kernel::u64(_base);
+				borrow = digit >= borrow ? 0 : (borrow - digit + Kernel::u64(_base) - 1) / Kernel::u64(_base);
+			}
 
-		bool neg_M = M.is_negative();
-		bool neg_N = N.is_negative();
-		bool neg_Q = neg_M != neg_N;
+			if (!carry && !borrow)
+				break;
 
-		if (neg_M) M *= -1;
-		div_positive(M, neg_N ? -N : N, Q);
-		if (neg_Q) Q *= -1;
+			cut_exp = exact_lo;
+		}
 
+		_digits.assign(sum[neg], sum[neg] + width);
+		_ms_exp = lo + width - 1;
+		_neg = neg;
+		trim();
 		return *this;
 	}
 
-	void compile_test()
+	// this = (sum of products) / den, the numerator is fused, then divided once.
+	Number& assign_quotient(const ProductTerm* terms, int count, const Number& den)
 	{
-		Number no0(1.0);
-		Number no1(1, 10);
-		Number no2((long long)1e15);
-
-		no2 += no1;
-		no2 -= no1;
-		no2 *= no1;
-		no2 /= no1;
-
-		no1 += 0.5;
-		no1 -= 0.5;
-
-		no1 *= 0.7;
-		no1 *= no2;
-
-		no2 ^= 4;
-		no1 = no2 ^ 0;
+		if (is_self(den))
+		{
+			Number copy_of_den{ den };
+			return assign_quotient(terms, count, copy_of_den);
+		}
 
-		no0 = no2 / 4.5;
-		no1 = no1 * 48.78;
+		assign_products(terms, count);
+		return *this /= den;
 	}
 
-public:
-
 	Number convert_base(int new_base, double precision_in_new_base) const
 	{
 		if (new_base == this->get_base())
 			return *this;
 
-		Number int_result = convert_int_base(new_base, precision_in_new_base);
-		Number frac_result = convert_frac_result(new_base, precision_in_new_base);
+		if (is_zero_strict())
+			return Number(BasePrecision::V, 0, precision_in_new_base, new_base);
 
-		int_result += frac_result;
-		int_result.trim();
-		return int_result;
+		if (!is_negative())
+			return convert_positive(new_base, precision_in_new_base);
+
+		Number result = abs(*this).convert_positive(new_base, precision_in_new_base);
+		result.mul_minus_1();
+		return result;
 	}
 
 	Number convert_base(int new_base) const
@@ -1351,6 +4551,176 @@ public:
 
 };
 
+static_assert(std::is_nothrow_move_constructible<Number>::value, "Number must move without throwing");
+
+/*
+Expr
+	Opt-in fused expressions. An operand wrapped by lazy() turns +, - and *
+	into a light expression object, evaluated once when it is assigned to a
+	Number (Number::assign_products):
+
+		Number r = lazy(a) * b + lazy(c) * d;	// a*b + c*d
+		r = lazy(x) * x - y;					// x*x - y
+		r = (lazy(a) + b) / c;					// (a+b)/c
+
+	Sums of operands and of products of two operands are fused: one
+	truncation and no full-size temporary. A division ends the expression,
+	its numerator is fused. The result takes the base and precision of the
+	first operand, or keeps those of the Number assigned to.
+
+	The expression only refers to its operands, evaluate it in the same
+	statement (not kept in an auto variable).
+*/
+namespace Expr {
+
+struct Operand
+{
+	const Number* x;
+};
+
+inline Operand lazy(const Number& x) { return { &x }; }
+
+template<int N>
+struct Sum
+{
+	ProductTerm terms[N];
+};
+
+template<int N>
+struct Quot
+{
+	Sum<N> num;
+	const Number* den;
+};
+
+template<class T> struct is_expr : std::false_type {};
+template<> struct is_expr<Operand> : std::true_type {};
+template<int N> struct is_expr<Sum<N>> : std::true_type {};
+
+inline Sum<1> to_sum(const Number& x) { return { { { &x, nullptr, false } } }; }
+inline Sum<1> to_sum(Operand x) { return to_sum(*x.x); }
+template<int N> Sum<N> to_sum(const Sum<N>& x) { return x; }
+
+template<int N, int M>
+Sum<N + M> join(const Sum<N>& l, const Sum<M>& r, bool subtract)
+{
+	Sum<N + M> s;
+	for (int i = 0; i < N; i++)
+		s.terms[i] = l.terms[i];
+	for (int i = 0; i < M; i++)
+		s.terms[N + i] = { r.terms[i].x, r.terms[i].y, r.terms[i].neg != subtract };
+	return s;
+}
+
+inline Sum<1> operator * (Operand x, Operand y) { return { { { x.x, y.x, false } } }; }
+inline Sum<1> operator * (Operand x, const Number& y) { return x * lazy(y); }
+inline Sum<1> operator * (const Number& x, Operand y) { return lazy(x) * y; }
+
+inline Sum<1> operator - (Operand x) { return { { { x.x, nullptr, true } } }; }
+template<int N> Sum<N> operator - (Sum<N> x) { for (auto& term : x.terms) term.neg = !term.neg; return x; }
+
+template<class L, class R, class = std::enable_if_t<is_expr<L>::value>>
+auto operator + (const L& l, const R& r) -> decltype(join(to_sum(l), to_sum(r), false)) { return join(to_sum(l), to_sum(r), false); }
+template<class L, class R, class = std::enable_if_t<is_expr<L>::value>>
+auto operator - (const L& l, const R& r) -> decltype(join(to_sum(l), to_sum(r), true)) { return join(to_sum(l), to_sum(r), true); }
+
+inline Sum<2> operator + (const Number& l, Operand r) { return join(to_sum(l), to_sum(r), false); }
+inline Sum<2> operator - (const Number& l, Operand r) { return join(to_sum(l), to_sum(r), true); }
+template<int N> Sum<N + 1> operator + (const Number& l, const Sum<N>& r) { return join(to_sum(l), r, false); }
+template<int N> Sum<N + 1> operator - (const Number& l, const Sum<N>& r) { return join(to_sum(l), r, true); }
+
+template<int N> Quot<N> operator / (const Sum<N>& num, const Number& den) { return { num, &den }; }
+template<int N> Quot<N> operator / (const Sum<N>& num, Operand den) { return { num, den.x }; }
+inline Quot<1> operator / (Operand num, const Number& den) { return { to_sum(num), &den }; }
+inline Quot<1> operator / (Operand num, Operand den) { return { to_sum(num), den.x }; }
+
+}
+
+/*
+Binary splitting
+	s = sum(k = 0 ... n-1) t(k) * p(0)...p(k) / (q(0)...q(k))
+
+	p, q and t give integers: int, long long or an integer Number (for
+	factors beyond 64 bits). The range is halved down to single terms, and
+	the halves are merged with integer products only:
+
+		P = P1 * P2,  Q = Q1 * Q2,  T = T1 * Q2 + P1 * T2,  s = T / Q
+
+	So a series of n terms costs O(M(m) log n) for m digits of Q and one
+	division, instead of n full precision divisions. Halves of at least
+	Kernel::PARALLEL_GRAIN terms are forked, so are the four products of a
+	merge of that many digits, outside of a MemoryScope only (an arena is
+	not thread safe, see Kernel::may_fork_numbers).
+
+		// e = sum 1 / k!
+		Number e = binary_splitting(3300, [](int) { return 1; }, [](int k) { return std::max(k, 1); }, [](int) { return 1; }, 10000);
+*/
+template <class P, class Q, class T>
+Number binary_splitting(int n, P p, Q q, T t, int precision_in_10 = Number::DEFAULT_PRECISION_IN_10, int base = Number::DEFAULT_BASE)
+{
+	struct Split
+	{
+		Number p, q, t;
+	};
+
+	auto digits = [](const Number& x) { return x.ms_exp() - x.ls_exp() + 1; };
+
+	// an integer in base, also from a Number of another base or precision.
+	auto integer = [base](const auto& value, int precision = 0)
+	{
+		Number x(0, precision, base);
+		x += value;
+		return x;
+	};
+
+	// [a, b) => P, Q, T, integers in base.
+	auto split = [&](auto& self, int a, int b) -> Split
+	{
+		if (b - a == 1)
+		{
+			Split leaf{ integer(p(a)), integer(q(a)), integer(t(a)) };
+			leaf.t *= leaf.p;
+			return leaf;
+		}
+
+		// results are built in place by the thread computing them, so they are moved (not copied) on.
+		int m = a + (b - a) / 2;
+		std::optional<Split> left, right;
+		Kernel::fork_tasks(2, Kernel::may_fork_numbers(b - a), [&](int i)
+		{
+			if (i == 0)
+				left.emplace(self(self, a, m));
+			else
+				right.emplace(self(self, m, b));
+		});
+
+		// P1 * P2, Q1 * Q2, T1 * Q2, P1 * T2
+		std::optional<Number> products[4];
+		Kernel::fork_tasks(4, Kernel::may_fork_numbers(std::min(digits(left->q), digits(right->q))), [&](int i)
+		{
+			switch (i)
+			{
+			case 0: products[0].emplace(left->p * right->p); break;
+			case 1: products[1].emplace(left->q * right->q); break;
+			case 2: products[2].emplace(left->t * right->q); break;
+			default: products[3].emplace(left->p * right->t); break;
+			}
+		});
+
+		Split merged{ std::move(*products[0]), std::move(*products[1]), std::move(*products[2]) };
+		merged.t += *products[3];
+		return merged;
+	};
+
+	if (n <= 0)
+		return Number(0, precision_in_10, base);
+
+	Split sum = split(split, 0, n);
+	Number s = integer(sum.t, precision_in_10);
+	s /= sum.q;
+	return s;
+}
+
 }
 
 #endif
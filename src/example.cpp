@@ -4,66 +4,40 @@ using ArbitraryPrecision::Number;
 
 Number cal_e(int precision = 1000)
 {
-	Number e(1, precision);
-	Number one_over_fact_n(1, precision);
-
-	for (int i = 1; one_over_fact_n.is_not_zero_strict(); i++)
-	{
-		one_over_fact_n /= i;
-		e += one_over_fact_n;
-	} 
+	// e = sum 1/k!: p(k) = 1, q(0) = 1, q(k) = k, enough terms for n! > 10^precision
+	int n = 1;
+	for (double digits = 0; digits <= precision + 1; n++)
+		digits += std::log10(n);
+
+	auto p = [](int) { return 1; };
+	auto q = [](int k) { return std::max(k, 1); };
+	auto t = [](int) { return 1; };
+	return ArbitraryPrecision::binary_splitting(n, p, q, t, precision);
+}
 
-	return e;
+// arctan(u/v) = u*v/(u^2+v^2) * sum (2k)!!/(2k+1)!! * (u^2/(u^2+v^2))^k (Euler)
+Number arctan(long long u, long long v, int precision)
+{
+	const long long uu = u * u, ww = u * u + v * v;
+	const Number u2(uu, 0), w(ww, 0);
+	int n = int(precision / std::log10(double(ww) / double(uu))) + 2;
+
+	// 2k * u^2 and (2k + 1) * (u^2 + v^2) outgrow 64 bits, they are made as Numbers.
+	auto p = [&u2](int k) { return k ? Number(2 * k, 0) * u2 : Number(1, 0); };
+	auto q = [&w](int k) { return k ? Number(2 * k + 1, 0) * w : Number(1, 0); };
+	auto t = [](int) { return 1; };
+
+	Number sum = ArbitraryPrecision::binary_splitting(n, p, q, t, precision);
+	sum *= Number(u * v, 0);
+	sum /= ww;
+	return sum;
 }
 
 Number cal_pi(int precision = 1000)
 {
-	// pi = 88*arctan(3/79)-20*arctan(685601/69049993) 
-	const int x = 3, y = 79, pxy = 88;
-	const int u = 685601, v = 69049993, puv = -20;
-
-	Number sum_xy(0, precision);
-	Number sum_uv(0, precision);
-
-	Number x1(x, precision);
-	Number y1(y, precision);
-
-	Number u1(u, precision);
-	Number v1(v, precision);
-
-	Number XY = x1 / y1;
-	Number UV = u1 / v1;
-
-	Number x2 = x1 * x1;
-	Number y2 = y1 * y1;
-
-	Number u2 = u1 * u1;
-	Number v2 = v1 * v1;
-
-	int i = 0;
-	while (XY != 0 || UV != 0)
-	{
-		Number na = XY / (2 * i + 1);
-		Number nb = UV / (2 * i + 1);
-
-		XY *= x2; XY /= y2;
-		UV *= u2; UV /= v2;
-
-		if (i++ & 1)
-		{
-			sum_xy -= na;
-			sum_uv -= nb;
-		}
-		else
-		{
-			sum_xy += na;
-			sum_uv += nb;
-		}
-	}
-
-	sum_xy *= pxy;
-	sum_uv *= puv;
-	Number pi = sum_xy + sum_uv;
+	// pi = 88*arctan(3/79)-20*arctan(685601/69049993)
+	Number pi = arctan(3, 79, precision) * 88;
+	pi -= arctan(685601, 69049993, precision) * 20;
 	return pi;
 }
 
@@ -1,6 +1,7 @@
 ﻿#include "ap_number.h"
 #include <iostream>
 #include <string>
+#include <random>
 
 namespace ap = ArbitraryPrecision;
 using ap::Number;
@@ -133,13 +134,40 @@ bool print_test()
 		return false;
 	}
 
+	// every kernel table the CPU can run (add, sub, multiply by int, digits to chars) agrees with the scalar one.
+	using ap::Kernel::Cpu;
+	const ap::Kernel::Dispatch save_dispatch = ap::Kernel::dispatch();
+	auto linear_ops = [&]()
+	{
+		Number x{ const_2000_string, 2000, Number::DECIMAL_BASE };
+		x = (x + f1k) * 999999937 - c2k;
+		return x.to_dec_string() + (x * -7).to_dec_string();
+	};
+
+	ap::Kernel::dispatch() = ap::Kernel::make_dispatch(Cpu::SCALAR);
+	const std::string scalar = linear_ops();
+	for (Cpu cpu : { Cpu::SSE4, Cpu::AVX2, Cpu::AVX512 })
+	{
+		if (cpu > save_dispatch.cpu)
+			break;
+
+		ap::Kernel::dispatch() = ap::Kernel::make_dispatch(cpu);
+		if (linear_ops() != scalar)
+		{
+			ap::Kernel::dispatch() = save_dispatch;
+			std::cout << "Kernels of CPU level " << int(cpu) << ". Failed.\n";
+			return false;
+		}
+	}
+	ap::Kernel::dispatch() = save_dispatch;
+
 	std::cout << "Passed. "; std::cout << "Time cost: " << std::round((clock() - st) * 10 / CLOCKS_PER_SEC) / 10 << " sec.\n";
 	return true;
 }
 
 bool base_test()
 {
-	const std::initializer_list bases{ 2, 7, 10, 17, 12345, 1234567, 100000000 };
+	const std::initializer_list bases{ 2, 7, 10, 17, 12345, 1234567, 100000000, Number::BINARY_BASE };
 	//const std::initializer_list bases{ 100000000 };
 
 	auto factorial = [](Number& no, int n) {
@@ -171,6 +199,58 @@ bool base_test()
 		}
 	}
 
+	// Long integers survive the round trip through the divide and conquer conversion.
+	std::string long_digits = "-9";
+	for (int i = 1; long_digits.size() < 50000; i++)
+		long_digits += std::to_string(i * 7919 % 10007);
+
+	if (Number{ long_digits }.to_dec_string() != long_digits || Number{ long_digits, 10, 12345 }.to_dec_string() != long_digits)
+	{
+		std::cout << "Failed.\n";
+		return false;
+	}
+
+	// Forked conversion halves give the same digits, on the shared pool and on an executor of the caller.
+	{
+		// queues the jobs and never runs them: join() has to run every fork itself.
+		struct HoardingExecutor : ap::Kernel::Executor
+		{
+			std::vector<Job> jobs;
+			void submit(Job job) override { jobs.push_back(std::move(job)); }
+			int concurrency() const override { return 4; }
+		};
+
+		const int save_threads = ap::Kernel::THREADS;
+		const int save_grain = ap::Kernel::PARALLEL_GRAIN;
+		ap::Kernel::THREADS = 4;
+		ap::Kernel::PARALLEL_GRAIN = 64;
+
+		std::string pooled = Number{ long_digits, 10, 12345 }.to_dec_string();
+		HoardingExecutor hoarding;
+		std::string hoarded;
+		{
+			ap::Kernel::ExecutorScope scope{ hoarding };
+			hoarded = Number{ long_digits, 10, 12345 }.to_dec_string();
+		}
+
+		ap::Kernel::THREADS = save_threads;
+		ap::Kernel::PARALLEL_GRAIN = save_grain;
+		if (pooled != long_digits || hoarded != long_digits || hoarding.jobs.empty())
+		{
+			std::cout << "Forked conversion. Failed.\n";
+			return false;
+		}
+	}
+
+	// Decimal digits are only regrouped into DECIMAL_BASE and back, fractions included.
+	std::string long_fraction = long_digits.substr(0, 20000) + "." + long_digits.substr(20000) + "1";
+	Number decimal{ long_fraction, 40000, Number::DECIMAL_BASE };
+	if (decimal.to_dec_string() != long_fraction || decimal.convert_base(10).convert_base(10000).to_dec_string() != long_fraction)
+	{
+		std::cout << "Failed.\n";
+		return false;
+	}
+
 	std::cout << "Passed. "; std::cout << "Time cost: " << std::round((clock() - st) * 10 / CLOCKS_PER_SEC) / 10 << " sec.\n";
 	return true;
 }
@@ -207,6 +287,38 @@ bool neg_test()
 	no = new_no / -no;
 	if (no != -x) return failed(no);
 
+	// the sign flips when the subtrahend is larger, the fraction digits are kept.
+	no = Number{ "-0.1" } - Number{ "-5966958498" };
+	if (no.to_dec_string() != "5966958497.9") return failed(no);
+
+	no = Number{ "-0.1" } + 471;
+	if (no.to_dec_string() != "470.9" || abs(-no) != no) return failed(no);
+
+	// temporaries are reused for the result, on either side.
+	Number a{ "12.5", 1000 }, b{ "-3.25", 1000 };
+	if (a - b * 2 != 19) return failed(a);
+	if (-(a * 2) + b * 4 != -38) return failed(b);
+	if (std::move(b) - a != -15.75) return failed(a);
+
+	// short numbers keep their digits inline, grow past them and back.
+	Number small{ -7, 1000 };
+	Number big = small;
+	for (int i = 0; i < 8; i++)
+		big *= 1000000007;
+	for (int i = 0; i < 8; i++)
+		big /= 1000000007;
+	Number moved = std::move(big);
+	if (moved != small || Number(moved) != -7) return failed(moved);
+
+	// copies share the digits until one of them is written.
+	Number third{ 1, 1000 };
+	third /= -3;
+	std::string third_str = third.to_dec_string();
+	Number copy = third;
+	copy *= 2;
+	copy += third;
+	if (third.to_dec_string() != third_str || copy != third * 3) return failed(copy);
+
 	std::cout << "Passed. "; std::cout << "Time cost: " << std::round((clock() - st) * 10 / CLOCKS_PER_SEC) / 10 << " sec.\n";
 	return true;
 }
@@ -259,6 +371,15 @@ bool pow_test()
 	return true;
 }
 
+std::string random_digits(std::mt19937& gen, int count)
+{
+	std::string str(count, '0');
+	for (auto& ch : str)
+		ch = char('0' + gen() % 10);
+	str[0] = char('1' + gen() % 9);
+	return str;
+}
+
 bool div_test()
 {
 	int st = clock();
@@ -326,6 +447,110 @@ bool div_test()
 		return false;
 	}
 
+	// Newton reciprocal division must give the same truncated quotient as long division.
+	std::mt19937 gen{ 7 };
+	for (int base : { 10, 12345, Number::DEFAULT_BASE })
+	{
+		Number m{ random_digits(gen, 3000), 2000, base };
+		Number n{ random_digits(gen, 1200), 2000, base };
+		n /= 7;
+
+		int newton_threshold = ap::Kernel::DIV_NEWTON_THRESHOLD;
+		ap::Kernel::DIV_NEWTON_THRESHOLD = 1 << 30;
+		Number q_long = m / n;
+		ap::Kernel::DIV_NEWTON_THRESHOLD = 2;
+		Number q_newton = m / n;
+		ap::Kernel::DIV_NEWTON_THRESHOLD = newton_threshold;
+
+		if (q_long != q_newton)
+		{
+			std::cout << "Failed.\n";
+			return false;
+		}
+	}
+
+	// Knuth's Algorithm D on digit spans (least significant first): q * v + r == u, r < v, v restored.
+	auto divrem_holds = [](const std::vector<int>& u, const std::vector<int>& v, int base)
+	{
+		int nu = int(u.size()), nv = int(v.size());
+		std::vector<int> q(size_t(nu - nv + 1)), r(u), divisor(v);
+		r.push_back(0);
+		ap::Kernel::divrem(q.data(), r.data(), nu, divisor.data(), nv, base);
+
+		// q * v + r, row by row
+		std::vector<long long> sum(r.begin(), r.begin() + nv);
+		sum.resize(size_t(nu + 1));
+		for (int i = 0; i <= nu - nv; i++)
+		{
+			long long carry = 0;
+			for (int j = 0; j < nv || carry; j++)
+			{
+				long long digit = sum[size_t(i + j)] + (j < nv ? (long long)q[size_t(i)] * v[size_t(j)] : 0) + carry;
+				sum[size_t(i + j)] = digit % base;
+				carry = digit / base;
+			}
+		}
+
+		bool less = false;
+		for (int j = nv - 1; j >= 0 && !less; j--)
+		{
+			if (r[size_t(j)] != v[size_t(j)])
+			{
+				less = r[size_t(j)] < v[size_t(j)];
+				break;
+			}
+		}
+
+		return divisor == v && less && sum.back() == 0 && std::equal(u.begin(), u.end(), sum.begin());
+	};
+
+	for (int base : { 10, 12345, Number::DEFAULT_BASE, Number::BINARY_BASE })
+	{
+		// the trial digit passes the check on three digits and is still one too big: add back.
+		// u = (q + 1) * (v - v[0]) with v[0] > 0 and v already normalized.
+		std::vector<int> v{ base - 1, 12345 % base, base / 2 + 1 };
+		std::vector<int> u{ 0, 0, 0, 0 };
+		u[3] = ap::Kernel::mul_1(u.data() + 1, v.data() + 1, 2, base - 2, base);
+		std::vector<std::pair<std::vector<int>, std::vector<int>>> cases{ { u, v } };
+
+		// top divisor digit base - 1, as given and after scaling by 2, trial digits clamped below the base.
+		cases.push_back({ std::vector<int>(5, base - 1), { base - 2, 3, base - 1 } });
+		cases.push_back({ std::vector<int>(5, base - 1), { base - 1, base / 2 - 1 } });
+
+		// divisors of exactly two digits, and as long as the dividend.
+		cases.push_back({ { 7, base - 1, 0, base / 3, 1 }, { base - 5, base / 2 } });
+		cases.push_back({ { 1, 2, 3, base - 1 }, { base - 1, 0, 0, 1 } });
+		cases.push_back({ { 1, 2, 3, base - 1 }, { 1, 2, 3, base - 1 } });
+		cases.push_back({ { 0, 0, 0, base / 2 }, { 1, 0, 0, base / 2 } });
+
+		for (auto& [dividend, divisor] : cases)
+		{
+			if (!divrem_holds(dividend, divisor, base))
+			{
+				std::cout << "Knuth D, base " << base << ". Failed.\n";
+				return false;
+			}
+		}
+	}
+	// found by search, add back in small bases with random digits.
+	if (!divrem_holds({ 6, 2, 5, 4 }, { 9, 5, 7 }, 10) || !divrem_holds({ 8250, 6319, 1767, 2733, 5328 }, { 5683, 8676, 5233 }, 12345))
+	{
+		std::cout << "Knuth D. Failed.\n";
+		return false;
+	}
+
+	// Short division by an integer gives the same truncated quotient as long division.
+	Number m{ random_digits(gen, 600) };
+	m /= 3;
+	for (long long d : { 7LL, -12345LL, 999999937LL, 1LL << 40, -(1LL << 62) - 3 })
+	{
+		if (m / d != m / Number{ d })
+		{
+			std::cout << "Failed.\n";
+			return false;
+		}
+	}
+
 	Number x{ 1 , 100, 111 };
 	x /= 1001;
 	Number y{ x };
@@ -340,6 +565,266 @@ bool div_test()
 	return true;
 }
 
+bool mul_div_test()
+{
+	int st = clock();
+	std::cout << "Multiply-divide test... ";
+
+	// mul_div_equ streams x * num / den in one pass, the same truncated result as a multiplication and a division.
+	std::mt19937 gen{ 11 };
+	const std::pair<long long, long long> ratios[] = { { 9, 6241 }, { -685601, 69049993 }, { 3000000000LL, 7 }, { 1LL << 40, -(1LL << 40) - 1 } };
+	for (int base : { 10, 12345, Number::DEFAULT_BASE })
+	{
+		Number m{ random_digits(gen, 600), 2000, base };
+		m /= 3;
+
+		for (auto [num, den] : ratios)
+		{
+			Number fused{ m }, two_step{ m };
+			fused.mul_div_equ(num, den);
+			two_step *= Number{ num };
+			two_step /= den;
+			if (fused != two_step)
+			{
+				std::cout << "Failed.\n";
+				return false;
+			}
+		}
+
+		// the batch form, with folded neighbours, against one multiplication and division per ratio.
+		Number batched{ m }, two_step{ m };
+		batched.mul_div_equ({ { 3, 79 }, { 3, 79 }, { -685601, 69049993 }, { 685601, 69049993 }, { 1LL << 40, 3 } });
+		for (auto [num, den] : { std::pair<long long, long long>{ 9, 6241 }, { -685601LL * 685601, 69049993LL * 69049993 }, { 1LL << 40, 3 } })
+		{
+			two_step *= Number{ num };
+			two_step /= den;
+		}
+
+		if (batched != two_step)
+		{
+			std::cout << "Failed.\n";
+			return false;
+		}
+	}
+
+	// arctan terms stepped by (x/y)^2 both ways stay equal.
+	Number x1(3, 2000), y1(79, 2000);
+	Number x2 = x1 * x1, y2 = y1 * y1;
+	Number fused = x1 / y1, two_step = x1 / y1;
+	for (int i = 0; i < 200; i++)
+	{
+		fused.mul_div_equ({ { 3, 79 }, { 3, 79 } });
+		two_step *= x2; two_step /= y2;
+	}
+
+	if (fused != two_step)
+	{
+		std::cout << "Failed.\n";
+		return false;
+	}
+
+	std::cout << "Passed. "; std::cout << "Time cost: " << std::round((clock() - st) * 10 / CLOCKS_PER_SEC) / 10 << " sec.\n";
+	return true;
+}
+
+bool mul_test()
+{
+	int st = clock();
+	std::cout << "Multiply test... ";
+
+	std::mt19937 gen{ 2024 };
+	const int save_karatsuba = ap::Kernel::MUL_KARATSUBA_THRESHOLD;
+	const int save_toom3 = ap::Kernel::MUL_TOOM3_THRESHOLD;
+	const int save_ntt = ap::Kernel::MUL_NTT_THRESHOLD;
+
+	auto set_thresholds = [](int karatsuba, int toom3, int ntt)
+	{
+		ap::Kernel::MUL_KARATSUBA_THRESHOLD = karatsuba;
+		ap::Kernel::MUL_TOOM3_THRESHOLD = toom3;
+		ap::Kernel::MUL_NTT_THRESHOLD = ntt;
+	};
+
+	// Integer products are exact, all algorithms must agree on every digit.
+	// len_y == 0: square x, checked against x * copy_of_x.
+	const std::pair<int, int> sizes[] = { { 50, 50 }, { 3000, 2000 }, { 5000, 3000 }, { 9000, 700 }, { 20000, 20000 }, { 200, 0 }, { 20000, 0 } };
+	for (auto [len_x, len_y] : sizes)
+	{
+		Number x{ random_digits(gen, len_x) };
+		Number y{ len_y ? Number{ random_digits(gen, len_y) } : x };
+		auto product = [&]() { return len_y ? x * y : sqr(x); };
+
+		set_thresholds(1 << 30, 1 << 30, 1 << 30);
+		std::string basecase = (x * y).to_dec_string();
+
+		set_thresholds(4, 1 << 30, 1 << 30);
+		std::string karatsuba = product().to_dec_string();
+
+		set_thresholds(4, 8, 1 << 30);
+		std::string toom = product().to_dec_string();
+
+		set_thresholds(4, 8, 8);
+		std::string ntt = product().to_dec_string();
+
+		// thresholds down to a few digits: every algorithm recurses on shorter parts.
+		set_thresholds(2, 3, 1 << 30);
+		std::string small = product().to_dec_string();
+
+		set_thresholds(1 << 30, 1 << 30, 1 << 30);
+		std::string sqr_basecase = product().to_dec_string();
+
+		if (basecase != karatsuba || basecase != toom || basecase != ntt || basecase != small || basecase != sqr_basecase)
+		{
+			set_thresholds(save_karatsuba, save_toom3, save_ntt);
+			std::cout << "\n" << basecase << "\n" << karatsuba << "\n" << toom << "\n" << ntt << "\n" << small << "\n";
+			std::cout << "Failed.\n";
+			return false;
+		}
+	}
+
+	// Fractions are truncated at min_exp(): products have the digits of the exact product from min_exp() up, also
+	// when the columns left out below min_exp() carry into it. Digits biased to 0 and base - 1 make that common.
+	for (int base : { 10, 12345 })
+	{
+		for (int i = 0; i < 300; i++)
+		{
+			int precision = 20 + int(gen() % 40);
+			auto fraction = [&]()
+			{
+				Number z(0, precision, base);
+				for (int digits = -z.min_exp(); digits; digits--)
+				{
+					int r = int(gen() % 4);
+					z += r == 0 ? 0 : r == 1 ? base - 1 : int(gen() % base);
+					z /= base;
+				}
+				z += int(1 + gen() % 3);
+				return z;
+			};
+
+			Number x = fraction(), y = fraction();
+			Number exact_x(0, 4 * precision, base), exact_y(0, 4 * precision, base);
+			exact_x += x;
+			exact_y += y;
+
+			std::pair<Number, Number> products[] = { { x * y, exact_x * exact_y }, { x * x, exact_x * exact_x } };
+			for (auto& [truncated, exact] : products)
+			{
+				for (int exp = truncated.min_exp(); exp <= std::max(truncated.ms_exp(), exact.ms_exp()); exp++)
+				{
+					if (truncated(exp) != exact(exp))
+					{
+						std::cout << "\n" << truncated.to_dec_string() << "\n" << exact.to_dec_string() << "\n";
+						std::cout << "Failed.\n";
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	// products split over threads are bit-identical to the serial ones, with every algorithm.
+	{
+		const int save_threads = ap::Kernel::THREADS;
+		const int save_parallel = ap::Kernel::PARALLEL_GRAIN;
+		Number x{ random_digits(gen, 20000) }, y{ random_digits(gen, 6000) };
+		auto products = [&]() { return (x * y).to_dec_string() + sqr(y).to_dec_string(); };
+
+		const std::tuple<int, int, int> thresholds[] = { { 4, 1 << 30, 1 << 30 }, { 4, 8, 1 << 30 }, { 4, 8, 8 } };
+		for (auto [karatsuba, toom3, ntt] : thresholds)
+		{
+			set_thresholds(karatsuba, toom3, ntt);
+			ap::Kernel::THREADS = 1;
+			std::string serial = products();
+
+			ap::Kernel::THREADS = 4;
+			ap::Kernel::PARALLEL_GRAIN = 16;
+			std::string threaded = products();
+
+			ap::Kernel::THREADS = save_threads;
+			ap::Kernel::PARALLEL_GRAIN = save_parallel;
+			if (serial != threaded)
+			{
+				set_thresholds(save_karatsuba, save_toom3, save_ntt);
+				std::cout << "Threaded product. Failed.\n";
+				return false;
+			}
+		}
+	}
+
+	set_thresholds(save_karatsuba, save_toom3, save_ntt);
+
+	// (x + 1) * (x - 1) = x^2 - 1
+	Number x{ random_digits(gen, 30000) };
+	if ((x + 1) * (x - 1) != x * x - 1)
+	{
+		std::cout << "Failed.\n";
+		return false;
+	}
+
+	// fused expressions agree with the operators, also when they overwrite an operand.
+	{
+		using ap::Expr::lazy;
+		Number y{ random_digits(gen, 900) }, z{ "-0.5" };
+		Number fused = lazy(x) * y - lazy(y) * y + z;
+		Number quotient = (lazy(y) + z) / z;
+		z = lazy(z) * z - z;
+		if (fused != x * y - y * y - 0.5 || quotient != (y - 0.5) / -0.5 || z != 0.75)
+		{
+			std::cout << "Fused expression. Failed.\n";
+			return false;
+		}
+
+		// into a target of lower precision, the sum is truncated at its min_exp() like a product. b = trunc(1 / a) + ulp
+		// puts a * b just above 1, so the columns left out carry into min_exp(); 4 - a * b is just below 3, where the
+		// columns left out of the negative product borrow from it.
+		for (int i = 0; i < 50; i++)
+		{
+			std::string digits = "0." + std::to_string(1 + gen() % 9);
+			for (int d = 1; d < 60; d++)
+				digits += char('0' + gen() % 10);
+
+			Number a(digits, 60, 10), b(1, 60, 10);
+			b /= a;
+			b += Number("0." + std::string(59, '0') + "1", 60, 10);
+
+			Number exact_a(0, 400, 10), exact_b(0, 400, 10);
+			exact_a += a;
+			exact_b += b;
+
+			Number two(2, 60, 10), product(0, 5, 10), difference(0, 5, 10);
+			product = lazy(a) * b;
+			difference = lazy(two) * two - lazy(a) * b;
+
+			std::pair<Number, Number> sums[] = { { product, exact_a * exact_b }, { difference, Number(4, 400, 10) - exact_a * exact_b } };
+			for (auto& [truncated, exact] : sums)
+			{
+				for (int exp = truncated.min_exp(); exp <= std::max(truncated.ms_exp(), exact.ms_exp()); exp++)
+				{
+					if (truncated(exp) != exact(exp) || truncated.is_negative() != exact.is_negative())
+					{
+						std::cout << "\n" << truncated.to_dec_string() << "\n" << exact.to_dec_string() << "\n";
+						std::cout << "Fused expression. Failed.\n";
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	// the scratch workspace keeps one block of the largest need, the same product again takes nothing new.
+	auto& workspace = ap::Kernel::Workspace::local();
+	Number x2 = x * x;
+	size_t footprint = workspace.footprint();
+	if (!footprint || x * x != x2 || workspace.footprint() != footprint || workspace.high_water() > footprint)
+	{
+		std::cout << "Workspace " << footprint << " => " << workspace.footprint() << " bytes. Failed.\n";
+		return false;
+	}
+
+	std::cout << "Passed. "; std::cout << "Time cost: " << std::round((clock() - st) * 10 / CLOCKS_PER_SEC) / 10 << " sec.\n";
+	return true;
+}
+
 bool e_test()
 {
 #ifdef _DEBUG
@@ -452,16 +937,171 @@ bool pi_test()
 	return true;
 }
 
+bool series_test()
+{
+	// e = sum 1/k!, pi = 16*arctan(1/5)-4*arctan(1/239) by binary splitting
+
+#ifdef _DEBUG
+	const int PRECISION = 500;
+#else 
+	const int PRECISION = 10000;
+#endif
+
+	int st = clock();
+	std::cout << "Binary splitting(" << PRECISION << " digits) test... ";
+
+	auto e = [&](int base)
+	{
+		int n = 1;
+		for (double digits = 0; digits <= PRECISION + 1; n++)
+			digits += std::log10(n);
+		return ap::binary_splitting(n, [](int) { return 1; }, [](int k) { return std::max(k, 1); }, [](int) { return 1; }, PRECISION, base);
+	};
+
+	// arctan(1/v) = v/(1+v^2) * sum (2k)!!/(2k+1)!! * (1/(1+v^2))^k
+	auto arctan = [&](long long v, int base)
+	{
+		const long long w = 1 + v * v;
+		int n = int(PRECISION / std::log10(double(w))) + 2;
+		Number sum = ap::binary_splitting(n, [](int k) { return k ? 2 * k : 1; }, [w](int k) { return k ? (2 * k + 1) * w : 1LL; }, [](int) { return 1; }, PRECISION, base);
+		sum *= int(v);
+		sum /= w;
+		return sum;
+	};
+	auto pi = [&](int base) { return arctan(5, base) * 16 - arctan(239, base) * 4; };
+
+	extern std::string e_10000_string;
+	extern std::string pi_10000_string;
+	const std::pair<std::string, const std::string*> results[] = {
+		{ e(Number::DEFAULT_BASE).to_dec_string(), &e_10000_string },
+		{ e(Number::DECIMAL_BASE).to_dec_string(), &e_10000_string },
+		{ pi(Number::DEFAULT_BASE).to_dec_string(), &pi_10000_string },
+	};
+	for (auto& [str, expected] : results)
+	{
+		if (!proximate_equal(str, *expected))
+		{
+			std::cout << "\n" << str << "\n";
+			std::cout << expected->substr(0, PRECISION + 2) << "\n";
+
+			std::cout << "Failed!\n";
+			return false;
+		}
+	}
+
+	// forked splits and merges give the serial digits
+	{
+		const int save_threads = ap::Kernel::THREADS;
+		const int save_grain = ap::Kernel::PARALLEL_GRAIN;
+		ap::Kernel::THREADS = 4;
+		ap::Kernel::PARALLEL_GRAIN = 16;
+		auto forked = pi(Number::DEFAULT_BASE).to_dec_string();
+		ap::Kernel::THREADS = save_threads;
+		ap::Kernel::PARALLEL_GRAIN = save_grain;
+
+		if (forked != results[2].first)
+		{
+			std::cout << "\n" << forked << "\n" << results[2].first << "\n";
+			std::cout << "Failed!\n";
+			return false;
+		}
+	}
+
+	std::cout << "Passed. "; std::cout << "Time cost: " << std::round((clock() - st) * 10 / CLOCKS_PER_SEC) / 10 << " sec.\n";
+	return true;
+}
+
+bool memory_test()
+{
+#ifdef _DEBUG
+	const int PRECISION = 500;
+#else 
+	const int PRECISION = 10000;
+#endif
+
+	int st = clock();
+	std::cout << "Memory resource test... ";
+
+	extern std::string e_10000_string;
+	const int base = 23456;		// a base pair no other test converts, its radix powers are made below
+	const std::string digits = e_10000_string.substr(0, 3002);
+
+	Number e(0, PRECISION);
+	std::string inside;
+
+	// all temporaries on one arena, e gets a copy before it is released.
+	{
+		std::pmr::monotonic_buffer_resource arena;
+		ap::MemoryScope scope{ &arena };
+
+		Number sum(1, PRECISION);
+		Number one_over_fact_n(1, PRECISION);
+
+		for (int i = 1; !one_over_fact_n.is_zero(); i++)
+		{
+			one_over_fact_n /= i;
+			sum += one_over_fact_n;
+		}
+		e = std::move(sum);
+
+		inside = Number{ digits, 3000, base }.to_dec_string();
+	}
+
+	// the cached radix powers of the conversions above are not on the arena.
+	std::string outside = Number{ digits, 3000, base }.to_dec_string();
+	auto e_str = e.to_dec_string();
+
+	if (!proximate_equal(e_str, e_10000_string) || !proximate_equal(inside, digits) || outside != inside)
+	{
+		std::cout << "\n" << e_str.substr(0, 100) << "\n" << inside.substr(0, 100) << "\n" << outside.substr(0, 100) << "\n";
+		std::cout << "Failed!\n";
+		return false;
+	}
+
+	// with threads, work under the arena gives the same digits, and forks never share the arena (run under TSan).
+	{
+		const int save_threads = ap::Kernel::THREADS;
+		const int save_grain = ap::Kernel::PARALLEL_GRAIN;
+		ap::Kernel::THREADS = 4;
+		ap::Kernel::PARALLEL_GRAIN = 16;
+
+		auto series = []() { return ap::binary_splitting(1000, [](int) { return 1; }, [](int k) { return std::max(k, 1); }, [](int) { return 1; }, 2000); };
+		std::string pooled = series().to_dec_string();
+		std::string arena_series, arena_converted;
+		{
+			std::pmr::monotonic_buffer_resource arena;
+			ap::MemoryScope scope{ &arena };
+			arena_series = series().to_dec_string();
+			arena_converted = Number{ digits, 3000, base }.to_dec_string();
+		}
+
+		ap::Kernel::THREADS = save_threads;
+		ap::Kernel::PARALLEL_GRAIN = save_grain;
+		if (arena_series != pooled || arena_converted != inside || !proximate_equal(pooled, e_10000_string))
+		{
+			std::cout << "Forks under an arena. Failed.\n";
+			return false;
+		}
+	}
+
+	std::cout << "Passed. "; std::cout << "Time cost: " << std::round((clock() - st) * 10 / CLOCKS_PER_SEC) / 10 << " sec.\n";
+	return true;
+}
+
 void apn_test()
 {
 	load_test();
 	print_test();
 	base_test();
 	div_test();
+	mul_div_test();
+	mul_test();
 	e_test();
 	pi_test();
+	series_test();
 	pow_test();
 	neg_test();
+	memory_test();
 }
 
 int main()